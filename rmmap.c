@@ -0,0 +1,1060 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "simple_client.h"
+#include "rmmap.h"
+#include "rmmap_ssd.h"
+#include "rmmap_trace.h"
+
+#define PAGE_RESIDENT 0x1  // mapped in local memory
+#define PAGE_DIRTY    0x2  // written since it was faulted in
+#define PAGE_REMOTE   0x4  // remote copy is valid, otherwise page is zero
+#define PAGE_INFLIGHT 0x8  // prefetch posted, not installed yet
+// advice from rmadvise()
+#define PAGE_SEQUENTIAL 0x10
+#define PAGE_RANDOM     0x20
+#define PAGE_PINNED     0x40
+// touched since the clock hand last passed, a resident page without it is
+// mapped PROT_NONE so the next touch faults and sets it again
+#define PAGE_REFERENCED 0x80
+// installed by a prefetch and not touched yet, mapped PROT_NONE so the first
+// touch faults and is counted as a prefetch hit
+#define PAGE_PREFETCHED 0x100
+// protection the application asked for with mprotect(), base never maps a
+// page with more, and faults beyond it go to the application's handler
+#define PAGE_NOACCESS 0x200
+#define PAGE_READONLY 0x400
+#define PAGE_EXEC     0x800
+// kept when only the content of a page is discarded
+#define PAGE_MAPPING (PAGE_SEQUENTIAL | PAGE_RANDOM | PAGE_NOACCESS | PAGE_READONLY | PAGE_EXEC)
+
+#define PREFETCH_DEPTH RMMAP_QUEUE_DEPTH
+#define NO_PREFETCH SIZE_MAX
+// readahead window in pages, sequential advice and detected streams
+#define READAHEAD_SEQUENTIAL 8
+#define READAHEAD_NORMAL 2
+
+// the region is a memfd mapped twice, base is what the application sees and
+// its protection tracks page state, alias is always writable and is where
+// the library fills and reads pages, so no other thread ever sees a page
+// half installed or half evicted
+static int region_fd = -1;
+static char *base = NULL;
+static char *alias = NULL;
+static size_t length = 0;
+static size_t npages = 0;
+static uint16_t *page_state = NULL;
+
+static size_t resident = 0;
+static size_t max_resident = 0;
+static size_t clock_hand = 0;
+
+// registered bounce buffer, local pages themselves are never registered
+static char *staging = NULL;
+static struct ibv_mr *staging_mr = NULL;
+
+// registered buffers for async prefetches, indexed by wr_id - 1
+static char *prefetch_buffers = NULL;
+static struct ibv_mr *prefetch_mr = NULL;
+static size_t prefetch_page[PREFETCH_DEPTH];  // NO_PREFETCH if cancelled
+static uint8_t prefetch_busy[PREFETCH_DEPTH];
+static int prefetch_free = PREFETCH_DEPTH;
+
+static size_t last_fault = NO_PREFETCH;
+static size_t stream_window = READAHEAD_NORMAL;
+// part of a RMADV_WILLNEED range not posted yet, posted as prefetch buffers
+// free up
+static size_t willneed_next = 0;
+static size_t willneed_last = 0;
+static size_t pinned = 0;
+
+// pages held resident for buffers handed to the kernel, see rmmap_io_begin()
+static uint8_t *io_refs = NULL;
+static size_t io_held = 0;
+
+static struct rmmap_stats_t stats;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction old_action;
+
+void *rmmap_map_anon(size_t length, int prot) {
+    long ret = syscall(SYS_mmap, NULL, length, prot,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (ret == -1) {
+        return NULL;
+    }
+
+    return (void *) ret;
+}
+
+static char *map_region(int prot) {
+    long ret = syscall(SYS_mmap, NULL, length, prot, MAP_SHARED | MAP_NORESERVE,
+                       region_fd, 0);
+
+    if (ret == -1) {
+        return NULL;
+    }
+
+    // a child would share the pages but not the connection
+    syscall(SYS_madvise, ret, length, MADV_DONTFORK);
+    return (char *) ret;
+}
+
+uint64_t rmmap_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void *rmmap_base() {
+    return base;
+}
+
+size_t rmmap_length() {
+    return length;
+}
+
+int rmmap_contains(const void *addr) {
+    return base != NULL && (const char *) addr >= base &&
+           (const char *) addr < base + length;
+}
+
+// the region's own protection, bypassing an interposed mprotect() that
+// would take it for an application call
+static void protect(char *addr, size_t len, int prot) {
+    syscall(SYS_mprotect, addr, len, prot);
+}
+
+static char *page_addr(size_t page) {
+    return base + page * RMMAP_PAGE_SIZE;
+}
+
+static char *alias_addr(size_t page) {
+    return alias + page * RMMAP_PAGE_SIZE;
+}
+
+// release the local memory of pages, they read as zero afterwards
+static void punch_pages(size_t first, size_t count) {
+    fallocate(region_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (off_t) first * RMMAP_PAGE_SIZE, (off_t) count * RMMAP_PAGE_SIZE);
+}
+
+// protection of a page in base, follows its state, so a page that is not
+// resident, not referenced since the clock passed or not touched since it
+// was prefetched faults, and a clean one faults on write
+static int page_prot(size_t page) {
+    uint16_t state = page_state[page];
+
+    if (!(state & PAGE_RESIDENT) || !(state & PAGE_REFERENCED) ||
+        (state & (PAGE_PREFETCHED | PAGE_NOACCESS))) {
+        return PROT_NONE;
+    }
+
+    int prot = PROT_READ;
+
+    if ((state & PAGE_DIRTY) && !(state & PAGE_READONLY)) {
+        prot |= PROT_WRITE;
+    }
+
+    if (state & PAGE_EXEC) {
+        prot |= PROT_EXEC;
+    }
+
+    return prot;
+}
+
+static void map_page(size_t page) {
+    protect(page_addr(page), RMMAP_PAGE_SIZE, page_prot(page));
+}
+
+// copy a page in through the alias, it becomes visible with map_page()
+static void install(size_t page, const char *content) {
+    memcpy(alias_addr(page), content, RMMAP_PAGE_SIZE);
+}
+
+// the page must be unreachable through base
+static int writeback(size_t page) {
+    memcpy(staging, alias_addr(page), RMMAP_PAGE_SIZE);
+
+    int ret = rmmap_post_rw(IBV_WR_RDMA_WRITE, staging_mr, staging,
+                            page * RMMAP_PAGE_SIZE, RMMAP_PAGE_SIZE);
+
+    if (ret != 0) {
+        log_error("failed to write back page %lu, ret: %d", (unsigned long) page, ret);
+        return ret;
+    }
+
+    page_state[page] = (page_state[page] & ~PAGE_DIRTY) | PAGE_REMOTE;
+    return 0;
+}
+
+static int evict(size_t page) {
+    // cut off every thread first, faults wait on the lock until it is gone
+    protect(page_addr(page), RMMAP_PAGE_SIZE, PROT_NONE);
+
+    if (page_state[page] & PAGE_DIRTY) {
+        int ret = writeback(page);
+
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    if (page_state[page] & PAGE_REMOTE) {
+        // best effort, the remote copy stays authoritative
+        rmmap_ssd_store(page, alias_addr(page));
+    }
+
+    punch_pages(page, 1);
+
+    if (page_state[page] & PAGE_PINNED) {
+        pinned--;
+    }
+
+    page_state[page] &= ~(PAGE_RESIDENT | PAGE_PINNED | PAGE_REFERENCED | PAGE_PREFETCHED);
+    resident--;
+    return 0;
+}
+
+// clock, a referenced page gets a second chance, losing its bit and its
+// mapping, so it is only evicted if not touched for a full round
+static int evict_one() {
+    for (size_t i = 0; i < 2 * npages; i++) {
+        size_t page = clock_hand;
+        clock_hand = (clock_hand + 1) % npages;
+
+        if (!(page_state[page] & PAGE_RESIDENT) || (page_state[page] & PAGE_PINNED) ||
+            io_refs[page] != 0) {
+            continue;
+        }
+
+        if (page_state[page] & PAGE_REFERENCED) {
+            page_state[page] &= ~PAGE_REFERENCED;
+            map_page(page);
+            continue;
+        }
+
+        return evict(page);
+    }
+
+    return -ENOMEM;
+}
+
+static int fault_in(size_t page, uint8_t *source) {
+    int ret;
+
+    if (resident >= max_resident) {
+        ret = evict_one();
+
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    *source = RMMAP_TRACE_ZERO;
+
+    if (page_state[page] & PAGE_REMOTE) {
+        *source = RMMAP_TRACE_SSD;
+
+        // the ssd copy is used when cached and currently faster
+        if (rmmap_ssd_load(page, staging) != 0) {
+            *source = RMMAP_TRACE_REMOTE;
+
+            uint64_t start = rmmap_now_ns();
+            ret = rmmap_post_rw(IBV_WR_RDMA_READ, staging_mr, staging,
+                                page * RMMAP_PAGE_SIZE, RMMAP_PAGE_SIZE);
+
+            if (ret != 0) {
+                log_error("failed to read page %lu, ret: %d", (unsigned long) page, ret);
+                return ret;
+            }
+
+            rmmap_ssd_note_remote(rmmap_now_ns() - start);
+        }
+
+        install(page, staging);
+    }
+
+    // a page never written is the hole in the memfd and reads as zero,
+    // either way it is mapped read-only first and the write fault that
+    // follows marks it dirty
+    page_state[page] |= PAGE_RESIDENT | PAGE_REFERENCED;
+    resident++;
+    map_page(page);
+    return 0;
+}
+
+// a failed READ only releases the page, the next fault reads it again
+static void complete_prefetch(int slot, int status) {
+    size_t page = prefetch_page[slot];
+
+    prefetch_busy[slot] = 0;
+    prefetch_free++;
+
+    if (page == NO_PREFETCH) {
+        return;
+    }
+
+    page_state[page] &= ~PAGE_INFLIGHT;
+
+    if (status != 0) {
+        log_error("failed to prefetch page %lu, status: %d", (unsigned long) page, status);
+        return;
+    }
+
+    // without room the prefetched copy is simply discarded
+    if (resident >= max_resident && evict_one() != 0) {
+        return;
+    }
+
+    // filled through the alias only, the page stays PROT_NONE until touched,
+    // it starts referenced so the clock does not take it before the reader
+    // gets to it
+    install(page, prefetch_buffers + (size_t) slot * RMMAP_PAGE_SIZE);
+
+    page_state[page] |= PAGE_RESIDENT | PAGE_PREFETCHED | PAGE_REFERENCED;
+    resident++;
+}
+
+static int prefetch_range(size_t *first, size_t last, int block);
+
+static int reap_prefetches(int wait) {
+    uint64_t wr_ids[PREFETCH_DEPTH];
+    int status[PREFETCH_DEPTH];
+    int n = 0;
+
+    if (prefetch_free < PREFETCH_DEPTH) {
+        n = rmmap_poll_async(wr_ids, status, PREFETCH_DEPTH, wait);
+
+        if (n < 0) {
+            log_error("failed to reap prefetches, ret: %d", n);
+            return n;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        complete_prefetch((int) wr_ids[i] - 1, status[i]);
+    }
+
+    // continue a queued RMADV_WILLNEED with the freed buffers, a failed post
+    // gives the rest of it up
+    if (willneed_next < willneed_last &&
+        prefetch_range(&willneed_next, willneed_last, 0) != 0) {
+        willneed_next = willneed_last;
+    }
+
+    return n;
+}
+
+static void cancel_prefetch(size_t page) {
+    if (!(page_state[page] & PAGE_INFLIGHT)) {
+        return;
+    }
+
+    for (int slot = 0; slot < PREFETCH_DEPTH; slot++) {
+        if (prefetch_busy[slot] && prefetch_page[slot] == page) {
+            prefetch_page[slot] = NO_PREFETCH;
+        }
+    }
+
+    page_state[page] &= ~PAGE_INFLIGHT;
+}
+
+static int wait_prefetch(size_t page) {
+    while (page_state[page] & PAGE_INFLIGHT) {
+        int ret = reap_prefetches(1);
+
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+// post READs for the remote pages in [*first, last) that are not local yet,
+// in batches as deep as the free prefetch buffers, if block is not set
+// stop once they run out, *first is left at the first page not posted
+static int prefetch_range(size_t *first, size_t last, int block) {
+    char *locals[PREFETCH_DEPTH];
+    uint64_t offsets[PREFETCH_DEPTH], wr_ids[PREFETCH_DEPTH];
+    size_t page = *first;
+
+    if (last > npages) {
+        last = npages;
+    }
+
+    while (page < last) {
+        *first = page;
+
+        if (prefetch_free == 0) {
+            if (!block) {
+                return 0;
+            }
+
+            int ret = reap_prefetches(1);
+
+            if (ret < 0) {
+                return ret;
+            }
+
+            continue;
+        }
+
+        int n = 0;
+
+        for (int slot = 0; slot < PREFETCH_DEPTH && page < last; slot++) {
+            if (prefetch_busy[slot]) {
+                continue;
+            }
+
+            // skip pages that are local, on the way or were never written
+            while (page < last && (page_state[page] & (PAGE_RESIDENT | PAGE_INFLIGHT) ||
+                                   !(page_state[page] & PAGE_REMOTE))) {
+                page++;
+            }
+
+            if (page == last) {
+                break;
+            }
+
+            prefetch_busy[slot] = 1;
+            prefetch_page[slot] = page;
+            page_state[page] |= PAGE_INFLIGHT;
+
+            locals[n] = prefetch_buffers + (size_t) slot * RMMAP_PAGE_SIZE;
+            offsets[n] = page * RMMAP_PAGE_SIZE;
+            wr_ids[n] = slot + 1;
+            n++;
+            page++;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        prefetch_free -= n;
+
+        int ret = rmmap_post_async(IBV_WR_RDMA_READ, prefetch_mr, locals,
+                                   offsets, wr_ids, n, RMMAP_PAGE_SIZE);
+
+        if (ret != n) {
+            // the posted part completes as usual, only the rest is released
+            int posted = ret > 0 ? ret : 0;
+
+            log_error("posted %d of %d prefetches, ret: %d", posted, n, ret);
+
+            for (int i = posted; i < n; i++) {
+                int slot = (int) wr_ids[i] - 1;
+                page_state[prefetch_page[slot]] &= ~PAGE_INFLIGHT;
+                prefetch_busy[slot] = 0;
+            }
+
+            prefetch_free += n - posted;
+            *first = prefetch_page[(int) wr_ids[posted] - 1];
+            return ret < 0 ? ret : -EIO;
+        }
+    }
+
+    *first = last;
+    return 0;
+}
+
+// how the faulting page got local, for read_ahead()
+#define AHEAD_MISS 0  // read synchronously
+#define AHEAD_HIT  1  // first touch of a prefetched page
+#define AHEAD_WAIT 2  // its prefetch was still on the way
+
+static void read_ahead(size_t page, int how) {
+    size_t window = 0;
+
+    if (page_state[page] & PAGE_SEQUENTIAL) {
+        window = READAHEAD_SEQUENTIAL;
+    } else if (!(page_state[page] & PAGE_RANDOM)) {
+        if (how != AHEAD_MISS || page == last_fault + 1) {
+            // the reader caught up with the prefetches, read further ahead
+            if (how == AHEAD_WAIT && stream_window < READAHEAD_SEQUENTIAL) {
+                stream_window *= 2;
+            }
+
+            window = stream_window;
+        } else {
+            stream_window = READAHEAD_NORMAL;
+        }
+    }
+
+    // prefetched pages continue the stream wherever it got to, they never
+    // move it back
+    if (how == AHEAD_MISS || last_fault == NO_PREFETCH || page > last_fault) {
+        last_fault = page;
+    }
+
+    if (window > 0) {
+        size_t next = page + 1;
+        prefetch_range(&next, page + 1 + window, 0);
+    }
+}
+
+static void forward_fault(int sig, siginfo_t *info, void *context) {
+    if (old_action.sa_flags & SA_SIGINFO) {
+        old_action.sa_sigaction(sig, info, context);
+    } else if (old_action.sa_handler != SIG_DFL && old_action.sa_handler != SIG_IGN) {
+        old_action.sa_handler(sig);
+    } else {
+        // restore the default action, the access faults again and terminates
+        sigaction(SIGSEGV, &old_action, NULL);
+    }
+}
+
+// kind of access that faulted, from the page fault error code where the
+// architecture exposes it
+#define FAULT_READ    0
+#define FAULT_WRITE   1
+#define FAULT_EXEC    2
+#define FAULT_UNKNOWN 3
+
+static int fault_access(void *context) {
+#if defined(__x86_64__)
+    greg_t err = ((ucontext_t *) context)->uc_mcontext.gregs[REG_ERR];
+    return err & 0x10 ? FAULT_EXEC : err & 0x2 ? FAULT_WRITE : FAULT_READ;
+#else
+    return FAULT_UNKNOWN;
+#endif
+}
+
+static void on_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = (char *) info->si_addr;
+
+    if (!rmmap_contains(addr)) {
+        forward_fault(sig, info, context);
+        return;
+    }
+
+    size_t page = (addr - base) / RMMAP_PAGE_SIZE;
+    uint64_t start = rmmap_now_ns();
+    uint8_t op = RMMAP_TRACE_READ, source = RMMAP_TRACE_HIT;
+    int ret = 0, forward = 0, spurious = 0;
+
+    pthread_mutex_lock(&lock);
+
+    // install completed prefetches, the page may be among them
+    reap_prefetches(0);
+
+    uint16_t state = page_state[page];
+    int access = fault_access(context);
+    int prot = page_prot(page);
+
+    if ((state & PAGE_NOACCESS) ||
+        (access == FAULT_WRITE && (state & PAGE_READONLY)) ||
+        (access == FAULT_EXEC && !(state & PAGE_EXEC)) ||
+        (access == FAULT_UNKNOWN && prot != PROT_NONE && (state & (PAGE_READONLY | PAGE_DIRTY)))) {
+        // beyond what the application mapped
+        forward = 1;
+    } else if ((access == FAULT_READ && prot != PROT_NONE) ||
+               (access == FAULT_WRITE && (prot & PROT_WRITE))) {
+        // another thread already handled the page
+        spurious = 1;
+    } else if (page_state[page] & PAGE_INFLIGHT) {
+        source = RMMAP_TRACE_REMOTE;
+        ret = wait_prefetch(page);
+
+        if (ret == 0 && (page_state[page] & PAGE_PREFETCHED)) {
+            // arrived while we waited, map it for the access that faulted
+            page_state[page] &= ~PAGE_PREFETCHED;
+            page_state[page] |= PAGE_REFERENCED;
+            map_page(page);
+        } else if (ret == 0 && !(page_state[page] & PAGE_RESIDENT)) {
+            // discarded for lack of room
+            ret = fault_in(page, &source);
+        }
+
+        if (ret == 0) {
+            read_ahead(page, AHEAD_WAIT);
+        }
+    } else if ((page_state[page] & PAGE_RESIDENT) && (page_state[page] & PAGE_PREFETCHED)) {
+        // first touch after a prefetch, keep the stream ahead of the reader
+        page_state[page] &= ~PAGE_PREFETCHED;
+        page_state[page] |= PAGE_REFERENCED;
+        source = RMMAP_TRACE_PREFETCH;
+        read_ahead(page, AHEAD_HIT);
+        map_page(page);
+    } else if ((page_state[page] & PAGE_RESIDENT) && !(page_state[page] & PAGE_REFERENCED)) {
+        // touch after the clock hand passed
+        page_state[page] |= PAGE_REFERENCED;
+        map_page(page);
+    } else if (page_state[page] & PAGE_RESIDENT) {
+        // write to a clean page
+        page_state[page] |= PAGE_DIRTY;
+        rmmap_ssd_forget(page);
+        map_page(page);
+        op = RMMAP_TRACE_WRITE;
+    } else {
+        ret = fault_in(page, &source);
+
+        if (ret == 0) {
+            read_ahead(page, AHEAD_MISS);
+        }
+    }
+
+    if (ret == 0 && !forward && !spurious) {
+        rmmap_trace_record(op, source, addr - base, RMMAP_PAGE_SIZE, start);
+
+        stats.faults++;
+        stats.misses += source != RMMAP_TRACE_HIT && source != RMMAP_TRACE_PREFETCH;
+        stats.prefetch_hits += source == RMMAP_TRACE_PREFETCH;
+        stats.transfers += source == RMMAP_TRACE_SSD || source == RMMAP_TRACE_REMOTE;
+        stats.fault_ns += rmmap_now_ns() - start;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (forward) {
+        forward_fault(sig, info, context);
+        return;
+    }
+
+    if (ret != 0) {
+        log_error("unrecoverable fault at %p, ret: %d", addr, ret);
+        abort();
+    }
+}
+
+void rmmap_get_stats(struct rmmap_stats_t *out) {
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+int rmmap_init(size_t max_pages) {
+    length = rmmap_remote_length() & ~((uint64_t) RMMAP_PAGE_SIZE - 1);
+    npages = length / RMMAP_PAGE_SIZE;
+
+    if (npages == 0 || max_pages == 0) {
+        log_error("remote region too small or empty cache: %lu pages, cache %lu",
+            (unsigned long) npages, (unsigned long) max_pages);
+        return -EINVAL;
+    }
+
+    max_resident = max_pages;
+
+    region_fd = memfd_create("rmmap", MFD_CLOEXEC);
+
+    if (region_fd < 0 || ftruncate(region_fd, length) != 0) {
+        log_error("failed to create region memfd, errno: %d", -errno);
+        return -errno;
+    }
+
+    base = map_region(PROT_NONE);
+    alias = map_region(PROT_READ | PROT_WRITE);
+    page_state = rmmap_map_anon(npages * sizeof(uint16_t), PROT_READ | PROT_WRITE);
+    io_refs = rmmap_map_anon(npages, PROT_READ | PROT_WRITE);
+    staging = rmmap_map_anon(RMMAP_PAGE_SIZE, PROT_READ | PROT_WRITE);
+
+    if (base == NULL || alias == NULL || page_state == NULL || io_refs == NULL ||
+        staging == NULL) {
+        log_error("failed to reserve local address space, errno: %d", -errno);
+        base = NULL;
+        return -errno;
+    }
+
+    staging_mr = rmmap_reg_local(staging, RMMAP_PAGE_SIZE);
+
+    if (staging_mr == NULL) {
+        base = NULL;
+        return -errno;
+    }
+
+    prefetch_buffers = rmmap_map_anon(PREFETCH_DEPTH * RMMAP_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    prefetch_mr = prefetch_buffers != NULL ?
+        rmmap_reg_local(prefetch_buffers, PREFETCH_DEPTH * RMMAP_PAGE_SIZE) : NULL;
+
+    if (prefetch_mr == NULL) {
+        log_error("failed to setup prefetch buffers");
+        base = NULL;
+        return -ENOMEM;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &old_action) != 0) {
+        log_error("failed to install fault handler, errno: %d", -errno);
+        base = NULL;
+        return -errno;
+    }
+
+    log_info("remote region mapped: addr=%p, length=%lu, cache pages=%lu",
+        base, (unsigned long) length, (unsigned long) max_resident);
+    return 0;
+}
+
+static int pin_range(size_t first, size_t last) {
+    size_t need = 0;
+
+    for (size_t page = first; page < last; page++) {
+        need += !(page_state[page] & PAGE_PINNED);
+    }
+
+    // leave at least one evictable page for faults elsewhere, pages held
+    // for the kernel can not be evicted either
+    if (pinned + io_held + need >= max_resident) {
+        return -ENOMEM;
+    }
+
+    size_t next = first;
+    int ret = prefetch_range(&next, last, 1);
+
+    for (size_t page = first; page < last && ret == 0; page++) {
+        uint8_t source;
+
+        ret = wait_prefetch(page);
+
+        if (ret == 0 && !(page_state[page] & PAGE_RESIDENT)) {
+            ret = fault_in(page, &source);
+        }
+
+        if (ret == 0 && !(page_state[page] & PAGE_PINNED)) {
+            page_state[page] |= PAGE_PINNED;
+            pinned++;
+        }
+    }
+
+    return ret;
+}
+
+int rmadvise(void *addr, size_t len, int advice) {
+    if (!rmmap_contains(addr) || len == 0) {
+        return -EINVAL;
+    }
+
+    uint64_t start = rmmap_now_ns();
+
+    size_t first = ((char *) addr - base) / RMMAP_PAGE_SIZE;
+    size_t last = ((char *) addr - base + len + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+    int ret = 0;
+
+    if (last > npages) {
+        last = npages;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    reap_prefetches(0);
+
+    switch (advice) {
+        case RMADV_NORMAL:
+        case RMADV_RANDOM:
+        case RMADV_SEQUENTIAL:
+            for (size_t page = first; page < last; page++) {
+                page_state[page] &= ~(PAGE_SEQUENTIAL | PAGE_RANDOM);
+                page_state[page] |= advice == RMADV_RANDOM ? PAGE_RANDOM :
+                                    advice == RMADV_SEQUENTIAL ? PAGE_SEQUENTIAL : 0;
+            }
+            break;
+        case RMADV_WILLNEED:
+            // never more than the cache can hold, what does not fit in the
+            // prefetch buffers now is queued instead of waited for
+            willneed_next = first;
+            willneed_last = last;
+
+            if (willneed_last - willneed_next > max_resident - pinned - io_held - 1) {
+                willneed_last = willneed_next + (max_resident - pinned - io_held - 1);
+            }
+
+            ret = prefetch_range(&willneed_next, willneed_last, 0);
+
+            if (ret != 0) {
+                willneed_next = willneed_last;
+            }
+            break;
+        case RMADV_DONTNEED:
+            // unlike rmmap_drop() the content is kept, dirty pages are
+            // written back before they leave
+            for (size_t page = first; page < last && ret == 0; page++) {
+                cancel_prefetch(page);
+
+                if (page_state[page] & PAGE_RESIDENT) {
+                    ret = evict(page);
+                }
+            }
+            break;
+        case RMADV_PIN:
+            ret = pin_range(first, last);
+            break;
+        case RMADV_UNPIN:
+            for (size_t page = first; page < last; page++) {
+                if (page_state[page] & PAGE_PINNED) {
+                    page_state[page] &= ~PAGE_PINNED;
+                    pinned--;
+                }
+            }
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+    }
+
+    if (ret == 0) {
+        rmmap_trace_record(RMMAP_TRACE_ADVICE, advice, first * RMMAP_PAGE_SIZE,
+                           (last - first) * RMMAP_PAGE_SIZE, start);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+static void io_release(size_t first, size_t last) {
+    for (size_t page = first; page < last; page++) {
+        if (--io_refs[page] == 0) {
+            io_held--;
+        }
+    }
+}
+
+// the part of [addr, addr + len) inside the region, in pages
+static int io_pages(const void *addr, size_t len, size_t *first, size_t *last)
+    __attribute__((access(none, 1)));
+
+static int io_pages(const void *addr, size_t len, size_t *first, size_t *last) {
+    const char *start = (const char *) addr, *end = start + len;
+
+    if (base == NULL || len == 0 || end <= base || start >= base + length) {
+        return 0;
+    }
+
+    start = start < base ? base : start;
+    end = end > base + length ? base + length : end;
+
+    *first = (start - base) / RMMAP_PAGE_SIZE;
+    *last = (end - base + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+    return 1;
+}
+
+int rmmap_io_begin(const void *addr, size_t len, int write) {
+    size_t first, last;
+    int ret = 0;
+
+    if (!io_pages(addr, len, &first, &last)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    // leave at least one evictable page for faults elsewhere
+    if (pinned + io_held + (last - first) >= max_resident) {
+        pthread_mutex_unlock(&lock);
+        return -ENOMEM;
+    }
+
+    reap_prefetches(0);
+
+    size_t page;
+
+    for (page = first; page < last; page++) {
+        uint64_t start = rmmap_now_ns();
+        uint8_t source = RMMAP_TRACE_HIT;
+
+        if (io_refs[page] == UINT8_MAX) {
+            ret = -EBUSY;
+            break;
+        }
+
+        // the kernel fails such an access with EFAULT as well
+        if ((page_state[page] & PAGE_NOACCESS) ||
+            (write && (page_state[page] & PAGE_READONLY))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        ret = wait_prefetch(page);
+
+        if (ret == 0 && !(page_state[page] & PAGE_RESIDENT)) {
+            ret = fault_in(page, &source);
+        }
+
+        if (ret != 0) {
+            break;
+        }
+
+        if (io_refs[page]++ == 0) {
+            io_held++;
+        }
+
+        if (page_state[page] & PAGE_PREFETCHED) {
+            page_state[page] &= ~PAGE_PREFETCHED;
+            source = RMMAP_TRACE_PREFETCH;
+            stats.prefetch_hits++;
+        }
+
+        page_state[page] |= PAGE_REFERENCED;
+
+        if (write) {
+            page_state[page] |= PAGE_DIRTY;
+            rmmap_ssd_forget(page);
+        }
+
+        map_page(page);
+
+        if (source != RMMAP_TRACE_HIT) {
+            rmmap_trace_record(RMMAP_TRACE_READ, source, page * RMMAP_PAGE_SIZE,
+                               RMMAP_PAGE_SIZE, start);
+        }
+    }
+
+    if (ret != 0) {
+        io_release(first, page);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return ret == 0 ? (int) (last - first) : ret;
+}
+
+void rmmap_io_end(const void *addr, size_t len) {
+    size_t first, last;
+
+    if (!io_pages(addr, len, &first, &last)) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    io_release(first, last);
+    pthread_mutex_unlock(&lock);
+}
+
+// discard pages, keeping only the state bits in keep
+static int drop_range(void *addr, size_t len, uint16_t keep) {
+    if (!rmmap_contains(addr) || len == 0) {
+        return -EINVAL;
+    }
+
+    uint64_t start = rmmap_now_ns();
+    size_t first = ((char *) addr - base) / RMMAP_PAGE_SIZE;
+    size_t last = ((char *) addr - base + len + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+
+    if (last > npages) {
+        last = npages;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    protect(page_addr(first), (last - first) * RMMAP_PAGE_SIZE, PROT_NONE);
+    punch_pages(first, last - first);
+
+    // the queued RMADV_WILLNEED is stale once part of it is discarded
+    if (willneed_next < last && first < willneed_last) {
+        willneed_next = willneed_last;
+    }
+
+    for (size_t page = first; page < last; page++) {
+        cancel_prefetch(page);
+
+        if (page_state[page] & PAGE_RESIDENT) {
+            resident--;
+        }
+        if (page_state[page] & PAGE_PINNED) {
+            pinned--;
+        }
+        page_state[page] &= keep;
+        rmmap_ssd_forget(page);
+    }
+
+    rmmap_trace_record(RMMAP_TRACE_DROP, 0, first * RMMAP_PAGE_SIZE,
+                       (last - first) * RMMAP_PAGE_SIZE, start);
+
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int rmmap_drop(void *addr, size_t len) {
+    return drop_range(addr, len, PAGE_MAPPING);
+}
+
+int rmmap_release(void *addr, size_t len) {
+    return drop_range(addr, len, 0);
+}
+
+int rmmap_protect(void *addr, size_t len, int prot) {
+    if (!rmmap_contains(addr) || len == 0) {
+        return -EINVAL;
+    }
+
+    size_t first = ((char *) addr - base) / RMMAP_PAGE_SIZE;
+    size_t last = ((char *) addr - base + len + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+    uint16_t bits = 0;
+
+    if (last > npages) {
+        last = npages;
+    }
+
+    if (!(prot & (PROT_READ | PROT_WRITE | PROT_EXEC))) {
+        bits |= PAGE_NOACCESS;
+    }
+    if (!(prot & PROT_WRITE)) {
+        bits |= PAGE_READONLY;
+    }
+    if (prot & PROT_EXEC) {
+        bits |= PAGE_EXEC;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    for (size_t page = first; page < last; page++) {
+        page_state[page] = (page_state[page] & ~(PAGE_NOACCESS | PAGE_READONLY | PAGE_EXEC)) | bits;
+
+        if (page_state[page] & PAGE_RESIDENT) {
+            map_page(page);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+size_t rmmap_env_size(const char *name, size_t fallback) {
+    const char *value = getenv(name);
+    return value != NULL ? strtoull(value, NULL, 0) : fallback;
+}
+
+int rmmap_open_env() {
+    const char *ip = getenv("RMMAP_SERVER");
+    uint16_t port = (uint16_t) rmmap_env_size("RMMAP_PORT", host_port);
+
+    int ret = rmmap_connect(ip != NULL ? ip : host_ip, port);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = rmmap_init(rmmap_env_size("RMMAP_CACHE_PAGES", 16384));
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    // tracing and the ssd tier are optional, failing them only disables them
+    const char *trace_path = getenv("RMMAP_TRACE");
+
+    if (trace_path != NULL && rmmap_trace_open(trace_path) != 0) {
+        log_error("tracing disabled");
+    }
+
+    const char *ssd_path = getenv("RMMAP_SSD_PATH");
+
+    if (ssd_path != NULL &&
+        rmmap_ssd_init(ssd_path, rmmap_env_size("RMMAP_SSD_PAGES", 262144), npages) != 0) {
+        log_error("ssd cache disabled");
+    }
+
+    return 0;
+}
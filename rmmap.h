@@ -0,0 +1,82 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#define RMMAP_PAGE_SIZE 4096
+
+// librmmap.so is built with -fvisibility=hidden, only symbols marked with
+// this are exported to the program
+#define RMMAP_EXPORT __attribute__((visibility("default")))
+
+// map the whole remote region at a local address, pages are faulted in on
+// access and at most max_resident of them are kept in local memory
+extern int rmmap_init(size_t max_resident);
+
+extern void *rmmap_base();
+
+extern size_t rmmap_length();
+
+extern int rmmap_contains(const void *addr);
+
+struct rmmap_stats_t {
+    uint64_t faults;     // all faults on the region
+    uint64_t misses;     // faults that brought a page in, the rest are
+                         // write upgrades and clock reference faults
+    uint64_t transfers;  // misses served from ssd or remote memory
+    uint64_t prefetch_hits;  // first touches of prefetched pages, counted in
+                             // faults but not in misses
+    uint64_t fault_ns;   // time spent handling faults
+};
+
+extern void rmmap_get_stats(struct rmmap_stats_t *stats);
+
+// discard the pages in range both locally and remotely, they read as zero
+// afterwards, their protection and advice are kept as with MADV_DONTNEED
+extern int rmmap_drop(void *addr, size_t length);
+
+// rmmap_drop() that also resets protection and advice, for pages that are
+// unmapped or freed
+extern int rmmap_release(void *addr, size_t length);
+
+// protection the application sees on the range, as mprotect(), accesses
+// beyond it are passed on to its SIGSEGV handler
+extern int rmmap_protect(void *addr, size_t length, int prot);
+
+// the kernel can not take a fault on a non-resident page and fails with
+// EFAULT instead, so buffers handed to it are made resident and held until
+// rmmap_io_end(), returns the number of pages held, 0 if the buffer is not
+// in the region
+// only the addresses are used, the buffer may be uninitialized
+extern int rmmap_io_begin(const void *addr, size_t length, int write)
+    __attribute__((access(none, 1)));
+
+extern void rmmap_io_end(const void *addr, size_t length)
+    __attribute__((access(none, 1)));
+
+// advice for rmadvise(), the first five match their madvise() counterparts
+#define RMADV_NORMAL     0  // default readahead on detected streams
+#define RMADV_RANDOM     1  // no readahead
+#define RMADV_SEQUENTIAL 2  // aggressive readahead
+#define RMADV_WILLNEED   3  // prefetch the range asynchronously
+#define RMADV_DONTNEED   4  // write back and drop local copies, keeps content
+#define RMADV_PIN        5  // fault in and keep resident
+#define RMADV_UNPIN      6
+
+extern RMMAP_EXPORT int rmadvise(void *addr, size_t length, int advice);
+
+// anonymous mapping that bypasses an interposed mmap()
+extern void *rmmap_map_anon(size_t length, int prot);
+
+// connect and map the region as configured by the environment
+//
+// RMMAP_SERVER      server address, host_ip by default
+// RMMAP_PORT        server port, host_port by default
+// RMMAP_CACHE_PAGES local pages kept resident, 16384 by default
+// RMMAP_SSD_PATH    cache file for evicted pages, no ssd tier if unset
+// RMMAP_SSD_PAGES   pages kept in the cache file, 262144 by default
+// RMMAP_TRACE       file to record remote accesses to, see rmmap_trace.h
+extern int rmmap_open_env();
+
+extern size_t rmmap_env_size(const char *name, size_t fallback);
+
+// monotonic clock in nanoseconds
+extern uint64_t rmmap_now_ns();
@@ -0,0 +1,844 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "simple_client.h"
+#include "rmmap.h"
+
+// LD_PRELOAD=./librmmap.so serves large malloc() and anonymous mmap()
+// requests from the remote region mapped by rmmap.c, configured as in
+// rmmap_open_env() plus
+//
+// RMMAP_THRESHOLD   smallest request placed in far memory, 1MiB by default
+//
+// far mappings keep the semantics of private anonymous ones, munmap(),
+// madvise(), mprotect(), mremap() and MAP_FIXED on them are emulated over
+// the region, except that mremap() can not move them to a fixed address
+//
+// the library is built with hidden visibility, only the interposed calls
+// marked RMMAP_EXPORT and rmadvise() are visible to the program
+//
+// the kernel can not fault far pages in, so the common I/O calls below make
+// their buffers resident first, see rmmap_io_begin(), anything else the
+// kernel touches directly in far memory fails with EFAULT
+
+#define ORDER_NUM 32
+#define NO_PAGE UINT32_MAX
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static size_t (*libc_malloc_usable_size)(void *ptr) = NULL;
+
+// set while the library itself allocates, everything goes to libc then
+static __thread int in_rmmap __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int enabled = 0;
+static size_t threshold = 1 << 20;
+
+// buddy allocator over the pages of the remote region, a block is cut from
+// the smallest free power of two that holds it and its unused tail is freed
+// again, freed pages merge with their free buddies
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t free_head[ORDER_NUM];
+static uint32_t *free_next = NULL;  // free list links, indexed by first page
+static uint32_t *free_prev = NULL;
+static uint8_t *free_order = NULL;  // order + 1 of the free block starting at page
+static uint8_t *page_used = NULL;   // set while a page belongs to a block
+static uint32_t *run_pages = NULL;  // pages of the block starting at page
+static size_t npages = 0;
+
+static void push_block(size_t start, int order) {
+    free_order[start] = order + 1;
+    free_prev[start] = NO_PAGE;
+    free_next[start] = free_head[order];
+
+    if (free_head[order] != NO_PAGE) {
+        free_prev[free_head[order]] = start;
+    }
+
+    free_head[order] = start;
+}
+
+static void remove_block(size_t start, int order) {
+    free_order[start] = 0;
+
+    if (free_prev[start] != NO_PAGE) {
+        free_next[free_prev[start]] = free_next[start];
+    } else {
+        free_head[order] = free_next[start];
+    }
+
+    if (free_next[start] != NO_PAGE) {
+        free_prev[free_next[start]] = free_prev[start];
+    }
+}
+
+// arena_lock held, start must be aligned to the order
+static void free_block(size_t start, int order) {
+    while (order + 1 < ORDER_NUM) {
+        size_t buddy = start ^ ((size_t) 1 << order);
+
+        if (buddy >= npages || free_order[buddy] != order + 1) {
+            break;
+        }
+
+        remove_block(buddy, order);
+        start = start < buddy ? start : buddy;
+        order++;
+    }
+
+    push_block(start, order);
+}
+
+// arena_lock held, split the pages into aligned blocks and free them
+static void release_pages(size_t first, size_t count) {
+    size_t end = first + count;
+
+    memset(page_used + first, 0, count);
+
+    while (first < end) {
+        int order = 0;
+
+        while (order + 1 < ORDER_NUM && first % ((size_t) 2 << order) == 0 &&
+               first + ((size_t) 2 << order) <= end) {
+            order++;
+        }
+
+        free_block(first, order);
+        first += (size_t) 1 << order;
+    }
+}
+
+// arena_lock held, take the free pages in range out of their blocks, pages
+// in use are left as they are
+static void claim_pages(size_t first, size_t count) {
+    size_t end = first + count;
+    size_t page = first;
+
+    while (page < end) {
+        if (page_used[page]) {
+            page++;
+            continue;
+        }
+
+        // every free page is in exactly one free block
+        int order = 0;
+        size_t start = page;
+
+        while (order + 1 < ORDER_NUM && free_order[start] != order + 1) {
+            order++;
+            start = page & ~(((size_t) 1 << order) - 1);
+        }
+
+        size_t block_end = start + ((size_t) 1 << order);
+        size_t stop = block_end < end ? block_end : end;
+
+        remove_block(start, order);
+        memset(page_used + page, 1, stop - page);
+
+        if (page > start) {
+            release_pages(start, page - start);
+        }
+        if (block_end > stop) {
+            release_pages(stop, block_end - stop);
+        }
+
+        page = stop;
+    }
+}
+
+// arena_lock held, NO_PAGE if no free block is large enough
+static size_t alloc_pages(size_t count) {
+    int order = 0;
+
+    while (order < ORDER_NUM && ((size_t) 1 << order) < count) {
+        order++;
+    }
+
+    int found = order;
+
+    while (found < ORDER_NUM && free_head[found] == NO_PAGE) {
+        found++;
+    }
+
+    if (found >= ORDER_NUM) {
+        return NO_PAGE;
+    }
+
+    size_t start = free_head[found];
+    remove_block(start, found);
+
+    // halves not needed go back, then the tail beyond count
+    while (found > order) {
+        found--;
+        push_block(start + ((size_t) 1 << found), found);
+    }
+
+    memset(page_used + start, 1, count);
+    run_pages[start] = count;
+
+    if (((size_t) 1 << order) > count) {
+        release_pages(start + count, ((size_t) 1 << order) - count);
+    }
+
+    return start;
+}
+
+static void rmmap_alloc_init() {
+    in_rmmap = 1;
+
+    threshold = rmmap_env_size("RMMAP_THRESHOLD", threshold);
+
+    int ret = rmmap_open_env();
+
+    if (ret != 0) {
+        log_error("far memory disabled, ret: %d", ret);
+        in_rmmap = 0;
+        return;
+    }
+
+    npages = rmmap_length() / RMMAP_PAGE_SIZE;
+    free_next = rmmap_map_anon(npages * sizeof(uint32_t), PROT_READ | PROT_WRITE);
+    free_prev = rmmap_map_anon(npages * sizeof(uint32_t), PROT_READ | PROT_WRITE);
+    free_order = rmmap_map_anon(npages, PROT_READ | PROT_WRITE);
+    page_used = rmmap_map_anon(npages, PROT_READ | PROT_WRITE);
+    run_pages = rmmap_map_anon(npages * sizeof(uint32_t), PROT_READ | PROT_WRITE);
+
+    if (free_next == NULL || free_prev == NULL || free_order == NULL ||
+        page_used == NULL || run_pages == NULL) {
+        log_error("far memory disabled, failed to map arena tables");
+        in_rmmap = 0;
+        return;
+    }
+
+    for (int i = 0; i < ORDER_NUM; i++) {
+        free_head[i] = NO_PAGE;
+    }
+
+    release_pages(0, npages);
+
+    enabled = 1;
+    in_rmmap = 0;
+}
+
+static int use_far(size_t size) {
+    if (in_rmmap || size < threshold) {
+        return 0;
+    }
+
+    pthread_once(&init_once, rmmap_alloc_init);
+    return enabled;
+}
+
+static size_t first_page(const void *ptr) {
+    return ((const char *) ptr - (const char *) rmmap_base()) / RMMAP_PAGE_SIZE;
+}
+
+static void *far_alloc(size_t size) {
+    size_t pages = (size + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+
+    if (pages == 0 || pages > npages) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&arena_lock);
+    size_t start = alloc_pages(pages);
+    pthread_mutex_unlock(&arena_lock);
+
+    if (start == NO_PAGE) {
+        return NULL;
+    }
+
+    return (char *) rmmap_base() + start * RMMAP_PAGE_SIZE;
+}
+
+// size of the block starting at ptr, 0 if ptr is not the start of one
+static size_t far_capacity(const void *ptr) {
+    if (((const char *) ptr - (const char *) rmmap_base()) % RMMAP_PAGE_SIZE != 0) {
+        return 0;
+    }
+
+    size_t start = first_page(ptr);
+    return page_used[start] ? (size_t) run_pages[start] * RMMAP_PAGE_SIZE : 0;
+}
+
+static char *far_page(size_t page) {
+    return (char *) rmmap_base() + page * RMMAP_PAGE_SIZE;
+}
+
+// give back the pages in range that are in use, the rest of their blocks
+// stays mapped
+static void far_unmap(size_t first, size_t count) {
+    size_t end = first + count < npages ? first + count : npages;
+    size_t page = first;
+
+    pthread_mutex_lock(&arena_lock);
+
+    while (page < end) {
+        if (!page_used[page]) {
+            page++;
+            continue;
+        }
+
+        size_t run = page;
+
+        while (run < end && page_used[run]) {
+            run++;
+        }
+
+        // release before reuse, so a new block always reads as zero
+        rmmap_release(far_page(page), (run - page) * RMMAP_PAGE_SIZE);
+        release_pages(page, run - page);
+        page = run;
+    }
+
+    pthread_mutex_unlock(&arena_lock);
+}
+
+// give back the pages of the block from the page at offset on
+static void far_trim(void *ptr, size_t offset) {
+    size_t start = first_page(ptr);
+    size_t pages = run_pages[start];
+    size_t keep = offset / RMMAP_PAGE_SIZE;
+
+    run_pages[start] = keep;
+    far_unmap(start + keep, pages - keep);
+}
+
+static void far_free(void *ptr) {
+    if (far_capacity(ptr) == 0) {
+        log_error("invalid free of far memory %p", ptr);
+        return;
+    }
+
+    far_trim(ptr, 0);
+}
+
+RMMAP_EXPORT void *malloc(size_t size) {
+    if (use_far(size)) {
+        void *ptr = far_alloc(size);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+
+    return __libc_malloc(size);
+}
+
+RMMAP_EXPORT void *calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (use_far(nmemb * size)) {
+        // far blocks are zero until written
+        void *ptr = far_alloc(nmemb * size);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+
+    return __libc_calloc(nmemb, size);
+}
+
+RMMAP_EXPORT void free(void *ptr) {
+    if (enabled && rmmap_contains(ptr)) {
+        far_free(ptr);
+        return;
+    }
+
+    __libc_free(ptr);
+}
+
+RMMAP_EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+
+    if (!enabled || !rmmap_contains(ptr)) {
+        // blocks owned by libc stay in libc
+        return __libc_realloc(ptr, size);
+    }
+
+    if (size == 0) {
+        far_free(ptr);
+        return NULL;
+    }
+
+    size_t capacity = far_capacity(ptr);
+
+    if (size <= capacity) {
+        // whole pages no longer needed go back to the arena
+        size_t keep = (size + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE * RMMAP_PAGE_SIZE;
+
+        if (keep < capacity) {
+            far_trim(ptr, keep);
+        }
+
+        return ptr;
+    }
+
+    void *new_ptr = malloc(size);
+
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+
+    memcpy(new_ptr, ptr, capacity);
+    far_free(ptr);
+    return new_ptr;
+}
+
+RMMAP_EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(ptr, nmemb * size);
+}
+
+// far blocks start on a page boundary, stricter alignments stay in libc
+RMMAP_EXPORT void *memalign(size_t alignment, size_t size) {
+    if (alignment <= RMMAP_PAGE_SIZE && use_far(size)) {
+        void *ptr = far_alloc(size);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+
+    return __libc_memalign(alignment, size);
+}
+
+RMMAP_EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+RMMAP_EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 ||
+        alignment == 0) {
+        return EINVAL;
+    }
+
+    void *ptr = memalign(alignment, size);
+
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+    return 0;
+}
+
+RMMAP_EXPORT size_t malloc_usable_size(void *ptr) {
+    if (enabled && rmmap_contains(ptr)) {
+        return far_capacity(ptr);
+    }
+
+    // libc has no internal alias for it, look the next definition up
+    if (libc_malloc_usable_size == NULL) {
+        libc_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    }
+
+    return libc_malloc_usable_size == NULL ? 0 : libc_malloc_usable_size(ptr);
+}
+
+static size_t pages_of(size_t length) {
+    return (length + RMMAP_PAGE_SIZE - 1) / RMMAP_PAGE_SIZE;
+}
+
+// the part of [addr, addr + length) inside far memory, 0 if there is none
+static int far_range(void *addr, size_t length, char **start, char **end) {
+    char *region = rmmap_base();
+    char *first = addr, *last = (char *) addr + pages_of(length) * RMMAP_PAGE_SIZE;
+
+    if (!enabled || length == 0 || last <= region || first >= region + rmmap_length()) {
+        return 0;
+    }
+
+    *start = first > region ? first : region;
+    *end = last < region + rmmap_length() ? last : region + rmmap_length();
+    return 1;
+}
+
+// run a call of the form nr(addr, length, arg) on the parts of the range
+// outside far memory
+static int outside_far(long nr, char *addr, size_t length, char *start, char *end, long arg) {
+    long ret = 0;
+
+    if (addr < start) {
+        ret = syscall(nr, addr, start - addr, arg);
+    }
+
+    if (ret == 0 && addr + pages_of(length) * RMMAP_PAGE_SIZE > end) {
+        ret = syscall(nr, end, addr + pages_of(length) * RMMAP_PAGE_SIZE - end, arg);
+    }
+
+    return (int) ret;
+}
+
+static int set_errno(int ret) {
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int is_far_mmap(void *addr, size_t length, int prot, int flags) {
+    return addr == NULL &&
+           (flags & MAP_ANONYMOUS) && (flags & MAP_PRIVATE) && !(flags & MAP_FIXED) &&
+           prot == (PROT_READ | PROT_WRITE) &&
+           use_far(length);
+}
+
+// a fresh anonymous mapping over far memory, the kernel would replace the
+// region itself
+static void *far_map_fixed(char *addr, size_t length, int prot, int flags) {
+    char *start, *end;
+
+    far_range(addr, length, &start, &end);
+
+    if (!(flags & MAP_ANONYMOUS) || start != addr ||
+        end != addr + pages_of(length) * RMMAP_PAGE_SIZE) {
+        log_error("can not map a file or over the edge of far memory at %p", addr);
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    pthread_mutex_lock(&arena_lock);
+    claim_pages(first_page(addr), pages_of(length));
+    pthread_mutex_unlock(&arena_lock);
+
+    rmmap_release(addr, length);
+
+    if (prot != (PROT_READ | PROT_WRITE)) {
+        rmmap_protect(addr, length, prot);
+    }
+
+    return addr;
+}
+
+RMMAP_EXPORT void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    char *start, *end;
+
+    if ((flags & MAP_FIXED) && far_range(addr, length, &start, &end)) {
+        if ((uintptr_t) addr % RMMAP_PAGE_SIZE != 0) {
+            errno = EINVAL;
+            return MAP_FAILED;
+        }
+
+        return far_map_fixed(addr, length, prot, flags);
+    }
+
+    if (is_far_mmap(addr, length, prot, flags)) {
+        void *ptr = far_alloc(length);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+
+    long ret = syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+    return ret == -1 ? MAP_FAILED : (void *) ret;
+}
+
+RMMAP_EXPORT void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+// only the pages in range are unmapped, allocators unmap the head and tail
+// of a larger mapping to align it
+RMMAP_EXPORT int munmap(void *addr, size_t length) {
+    char *start, *end;
+
+    if (!far_range(addr, length, &start, &end)) {
+        return (int) syscall(SYS_munmap, addr, length);
+    }
+
+    if ((uintptr_t) addr % RMMAP_PAGE_SIZE != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    far_unmap(first_page(start), (end - start) / RMMAP_PAGE_SIZE);
+    return outside_far(SYS_munmap, addr, length, start, end, 0);
+}
+
+RMMAP_EXPORT int madvise(void *addr, size_t length, int advice) {
+    char *start, *end;
+
+    if (!far_range(addr, length, &start, &end)) {
+        return (int) syscall(SYS_madvise, addr, length, advice);
+    }
+
+    if ((uintptr_t) addr % RMMAP_PAGE_SIZE != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int ret = 0;
+
+    switch (advice) {
+        case MADV_DONTNEED:
+        case MADV_FREE:
+        case MADV_REMOVE:
+            // private anonymous pages read as zero afterwards
+            ret = rmmap_drop(start, end - start);
+            break;
+        case MADV_NORMAL:
+        case MADV_RANDOM:
+        case MADV_SEQUENTIAL:
+        case MADV_WILLNEED:
+            ret = rmadvise(start, end - start, advice);
+            break;
+        default:
+            // nothing to do for the region, e.g. MADV_HUGEPAGE
+            break;
+    }
+
+    if (set_errno(ret) != 0) {
+        return -1;
+    }
+
+    return outside_far(SYS_madvise, addr, length, start, end, advice);
+}
+
+RMMAP_EXPORT int mprotect(void *addr, size_t length, int prot) {
+    char *start, *end;
+
+    if (!far_range(addr, length, &start, &end)) {
+        return (int) syscall(SYS_mprotect, addr, length, prot);
+    }
+
+    if ((uintptr_t) addr % RMMAP_PAGE_SIZE != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (set_errno(rmmap_protect(start, end - start, prot)) != 0) {
+        return -1;
+    }
+
+    return outside_far(SYS_mprotect, addr, length, start, end, prot);
+}
+
+// a far mapping grows in place while the pages behind it are free, and
+// moves to a new far or local mapping otherwise
+static void *far_remap(char *old_address, size_t old_size, size_t new_size, int flags) {
+    size_t first = first_page(old_address);
+    size_t old_pages = pages_of(old_size), new_pages = pages_of(new_size);
+
+    if ((uintptr_t) old_address % RMMAP_PAGE_SIZE != 0 || new_size == 0 ||
+        (flags & ~MREMAP_MAYMOVE) != 0) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    if (new_pages <= old_pages) {
+        far_unmap(first + new_pages, old_pages - new_pages);
+        return old_address;
+    }
+
+    pthread_mutex_lock(&arena_lock);
+
+    int free_behind = first + new_pages <= npages;
+
+    for (size_t page = first + old_pages; free_behind && page < first + new_pages; page++) {
+        free_behind = !page_used[page];
+    }
+
+    if (free_behind) {
+        claim_pages(first + old_pages, new_pages - old_pages);
+    }
+
+    pthread_mutex_unlock(&arena_lock);
+
+    if (free_behind) {
+        return old_address;
+    }
+
+    if (!(flags & MREMAP_MAYMOVE)) {
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+
+    void *ptr = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ptr == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    memcpy(ptr, old_address, old_size);
+    far_unmap(first, old_pages);
+    return ptr;
+}
+
+RMMAP_EXPORT void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) {
+    void *new_address = NULL;
+
+    if (flags & MREMAP_FIXED) {
+        va_list args;
+        va_start(args, flags);
+        new_address = va_arg(args, void *);
+        va_end(args);
+    }
+
+    if (enabled && rmmap_contains(old_address)) {
+        return far_remap(old_address, old_size, new_size, flags);
+    }
+
+    long ret = syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+    return ret == -1 ? MAP_FAILED : (void *) ret;
+}
+
+// hold a buffer resident around a system call, 1 if it has to be released
+static int io_begin(const void *buf, size_t count, int write)
+    __attribute__((access(none, 1)));
+
+static int io_begin(const void *buf, size_t count, int write) {
+    return enabled && rmmap_io_begin(buf, count, write) > 0;
+}
+
+static void io_end(const void *buf, size_t count) {
+    int saved_errno = errno;
+    rmmap_io_end(buf, count);
+    errno = saved_errno;
+}
+
+RMMAP_EXPORT ssize_t read(int fd, void *buf, size_t count) {
+    int held = io_begin(buf, count, 1);
+    ssize_t ret = syscall(SYS_read, fd, buf, count);
+
+    if (held) {
+        io_end(buf, count);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t write(int fd, const void *buf, size_t count) {
+    int held = io_begin(buf, count, 0);
+    ssize_t ret = syscall(SYS_write, fd, buf, count);
+
+    if (held) {
+        io_end(buf, count);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    int held = io_begin(buf, count, 1);
+    ssize_t ret = syscall(SYS_pread64, fd, buf, count, offset);
+
+    if (held) {
+        io_end(buf, count);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    int held = io_begin(buf, count, 0);
+    ssize_t ret = syscall(SYS_pwrite64, fd, buf, count, offset);
+
+    if (held) {
+        io_end(buf, count);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t pread64(int fd, void *buf, size_t count, off64_t offset) {
+    return pread(fd, buf, count, offset);
+}
+
+RMMAP_EXPORT ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset) {
+    return pwrite(fd, buf, count, offset);
+}
+
+// only the first 64 vectors are held
+static uint64_t iov_begin(const struct iovec *iov, int iovcnt, int write) {
+    uint64_t held = 0;
+
+    for (int i = 0; i < iovcnt && i < 64; i++) {
+        if (io_begin(iov[i].iov_base, iov[i].iov_len, write)) {
+            held |= 1ull << i;
+        }
+    }
+
+    return held;
+}
+
+static void iov_end(const struct iovec *iov, int iovcnt, uint64_t held) {
+    for (int i = 0; i < iovcnt && i < 64; i++) {
+        if (held & (1ull << i)) {
+            io_end(iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+}
+
+RMMAP_EXPORT ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    uint64_t held = iov_begin(iov, iovcnt, 1);
+    ssize_t ret = syscall(SYS_readv, fd, iov, iovcnt);
+    iov_end(iov, iovcnt, held);
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    uint64_t held = iov_begin(iov, iovcnt, 0);
+    ssize_t ret = syscall(SYS_writev, fd, iov, iovcnt);
+    iov_end(iov, iovcnt, held);
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+                 struct sockaddr *src_addr, socklen_t *addrlen) {
+    int held = io_begin(buf, len, 1);
+    ssize_t ret = syscall(SYS_recvfrom, fd, buf, len, flags, src_addr, addrlen);
+
+    if (held) {
+        io_end(buf, len);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    return recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+RMMAP_EXPORT ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *dest_addr, socklen_t addrlen) {
+    int held = io_begin(buf, len, 0);
+    ssize_t ret = syscall(SYS_sendto, fd, buf, len, flags, dest_addr, addrlen);
+
+    if (held) {
+        io_end(buf, len);
+    }
+
+    return ret;
+}
+
+RMMAP_EXPORT ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    return sendto(fd, buf, len, flags, NULL, 0);
+}
@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <string.h>
+
+#include "rmmap_kv.h"
+
+#define SLOT_EMPTY(slot) ((slot)->key_length == 0)
+
+static uint64_t hash_key(const char *key, size_t length) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) key[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint32_t slot_checksum(const struct kv_slot_t *slot) {
+    const uint8_t *bytes = (const uint8_t *) &slot->key_length;
+    size_t length = sizeof(*slot) - offsetof(struct kv_slot_t, key_length);
+    uint32_t sum = 0x811c9dc5u ^ slot->version;
+    for (size_t i = 0; i < length; i++) {
+        sum ^= bytes[i];
+        sum *= 0x01000193u;
+    }
+    return sum;
+}
+
+static struct kv_slot_t *table_slots(void *region) {
+    return (struct kv_slot_t *) ((char *) region + sizeof(struct kv_header_t));
+}
+
+static uint32_t home_slot(const struct kv_header_t *header, const char *key, size_t key_length) {
+    return (uint32_t) (hash_key(key, key_length) % header->slot_num);
+}
+
+// seqlock style update, readers see an odd version or a bad checksum while
+// the slot is in flight
+static void write_slot(struct kv_slot_t *slot, const struct kv_slot_t *content) {
+    struct kv_slot_t next = *content;
+    next.version = slot->version + 2;
+    next.checksum = slot_checksum(&next);
+
+    __atomic_store_n(&slot->version, slot->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->checksum = next.checksum;
+    slot->key_length = next.key_length;
+    slot->value_length = next.value_length;
+    memcpy(slot->key, next.key, sizeof(slot->key));
+    memcpy(slot->value, next.value, sizeof(slot->value));
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->version, next.version, __ATOMIC_RELAXED);
+}
+
+size_t rmmap_kv_size(uint32_t slot_num) {
+    return sizeof(struct kv_header_t) +
+           ((size_t) slot_num + RMMAP_KV_NEIGHBORHOOD - 1) * sizeof(struct kv_slot_t);
+}
+
+int rmmap_kv_format(void *region, size_t length) {
+    if (length < rmmap_kv_size(1)) {
+        return -EINVAL;
+    }
+
+    struct kv_header_t *header = (struct kv_header_t *) region;
+    memset(region, 0, length);
+
+    header->slot_num = (uint32_t) ((length - sizeof(*header)) / sizeof(struct kv_slot_t)
+                                   - (RMMAP_KV_NEIGHBORHOOD - 1));
+    header->slot_size = sizeof(struct kv_slot_t);
+    header->magic = RMMAP_KV_MAGIC;
+
+    struct kv_slot_t *slots = table_slots(region);
+    size_t total = (size_t) header->slot_num + RMMAP_KV_NEIGHBORHOOD - 1;
+    for (size_t i = 0; i < total; i++) {
+        slots[i].checksum = slot_checksum(&slots[i]);
+    }
+
+    return 0;
+}
+
+int rmmap_kv_put(void *region, const char *key, size_t key_length,
+                 const char *value, size_t value_length) {
+    struct kv_header_t *header = (struct kv_header_t *) region;
+    struct kv_slot_t *slots = table_slots(region);
+    uint32_t total = header->slot_num + RMMAP_KV_NEIGHBORHOOD - 1;
+
+    if (key_length == 0 || key_length > RMMAP_KV_KEY_SIZE ||
+        value_length > RMMAP_KV_VALUE_SIZE) {
+        return -EINVAL;
+    }
+
+    struct kv_slot_t content;
+    memset(&content, 0, sizeof(content));
+    content.key_length = (uint8_t) key_length;
+    content.value_length = (uint8_t) value_length;
+    memcpy(content.key, key, key_length);
+    memcpy(content.value, value, value_length);
+
+    uint32_t home = home_slot(header, key, key_length);
+
+    // update in place
+    for (uint32_t i = home; i < home + RMMAP_KV_NEIGHBORHOOD; i++) {
+        if (slots[i].key_length == key_length && memcmp(slots[i].key, key, key_length) == 0) {
+            write_slot(&slots[i], &content);
+            return 0;
+        }
+    }
+
+    // linear probe for the closest empty slot
+    uint32_t empty = home;
+    while (empty < total && !SLOT_EMPTY(&slots[empty])) {
+        empty++;
+    }
+
+    if (empty == total) {
+        return -ENOSPC;
+    }
+
+    // hop the empty slot back into the neighborhood of home
+    while (empty - home >= RMMAP_KV_NEIGHBORHOOD) {
+        uint32_t from = empty - (RMMAP_KV_NEIGHBORHOOD - 1);
+
+        for (; from < empty; from++) {
+            uint32_t from_home = home_slot(header, slots[from].key, slots[from].key_length);
+            if (empty - from_home < RMMAP_KV_NEIGHBORHOOD) {
+                break;
+            }
+        }
+
+        if (from == empty) {
+            return -ENOSPC;
+        }
+
+        // the entry is visible in both slots for a moment, never in neither
+        struct kv_slot_t moved = slots[from];
+        write_slot(&slots[empty], &moved);
+
+        struct kv_slot_t cleared;
+        memset(&cleared, 0, sizeof(cleared));
+        write_slot(&slots[from], &cleared);
+
+        empty = from;
+    }
+
+    write_slot(&slots[empty], &content);
+    return 0;
+}
+
+uint64_t rmmap_kv_neighborhood(const struct kv_header_t *header,
+                               const char *key, size_t key_length) {
+    return sizeof(struct kv_header_t) +
+           (uint64_t) home_slot(header, key, key_length) * sizeof(struct kv_slot_t);
+}
+
+int rmmap_kv_match(const struct kv_slot_t *slots,
+                   const char *key, size_t key_length,
+                   char *value, size_t *value_length) {
+    int torn = 0;
+
+    for (int i = 0; i < RMMAP_KV_NEIGHBORHOOD; i++) {
+        const struct kv_slot_t *slot = &slots[i];
+
+        if ((slot->version & 1) || slot->checksum != slot_checksum(slot)) {
+            torn = 1;
+            continue;
+        }
+
+        // lengths come from the remote side, never trust them past the slot
+        if (slot->key_length > RMMAP_KV_KEY_SIZE || slot->value_length > RMMAP_KV_VALUE_SIZE) {
+            continue;
+        }
+
+        if (slot->key_length == key_length && memcmp(slot->key, key, key_length) == 0) {
+            memcpy(value, slot->value, slot->value_length);
+            *value_length = slot->value_length;
+            return 0;
+        }
+    }
+
+    // a torn slot may be the one moving the key around
+    return torn ? -EAGAIN : -ENOENT;
+}
@@ -0,0 +1,48 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// hopscotch hash table laid out in an exported region, a key always lives
+// within RMMAP_KV_NEIGHBORHOOD slots of its home slot, so a client resolves
+// a GET with one RDMA READ of that neighborhood
+
+#define RMMAP_KV_MAGIC 0x766b6d6d72ull  // "rmmkv"
+#define RMMAP_KV_NEIGHBORHOOD 8
+#define RMMAP_KV_KEY_SIZE 16
+#define RMMAP_KV_VALUE_SIZE 36
+
+struct __attribute((packed)) kv_header_t {
+    uint64_t magic;
+    uint32_t slot_num;  // home slots, the table has neighborhood - 1 more
+    uint32_t slot_size;
+    uint8_t reserved[48];
+};
+
+struct __attribute((packed)) kv_slot_t {
+    uint32_t version;   // odd while the slot is being written
+    uint32_t checksum;  // over the rest of the slot
+    uint8_t key_length; // 0 for an empty slot
+    uint8_t value_length;
+    uint16_t reserved;
+    char key[RMMAP_KV_KEY_SIZE];
+    char value[RMMAP_KV_VALUE_SIZE];
+};
+
+// bytes needed for a table of slot_num home slots
+extern size_t rmmap_kv_size(uint32_t slot_num);
+
+extern int rmmap_kv_format(void *region, size_t length);
+
+// local insert or update on the owner of the region
+extern int rmmap_kv_put(void *region, const char *key, size_t key_length,
+                        const char *value, size_t value_length);
+
+// offset of the neighborhood holding key, it is RMMAP_KV_NEIGHBORHOOD slots
+extern uint64_t rmmap_kv_neighborhood(const struct kv_header_t *header,
+                                      const char *key, size_t key_length);
+
+// search a fetched neighborhood, returns 0 if found, -ENOENT if not and
+// -EAGAIN on a torn or in-flight slot, slots with out of range lengths are
+// skipped
+extern int rmmap_kv_match(const struct kv_slot_t *slots,
+                          const char *key, size_t key_length,
+                          char *value, size_t *value_length);
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <time.h>
+
+#include "simple_client.h"
+#include "rmmap.h"
+#include "rmmap_trace.h"
+
+// replay a trace recorded with RMMAP_TRACE against a running simple_server,
+// every access record touches the same offset of the mapped region and drop
+// and advice records repeat the call on the same range, so the cache, ssd
+// tier and transport see the original access pattern
+//
+// usage: rmmap_replay <trace> [speed]
+//
+// speed scales the original timing, 2 replays twice as fast and 0 replays
+// as fast as possible, 1 by default. the region is configured as in
+// rmmap_open_env(), set RMMAP_TRACE to record the replay itself
+
+static void wait_until(uint64_t deadline) {
+    uint64_t now = rmmap_now_ns();
+
+    if (now >= deadline) {
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = (deadline - now) / 1000000000ull;
+    ts.tv_nsec = (deadline - now) % 1000000000ull;
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [speed]\n", argv[0]);
+        return -1;
+    }
+
+    double speed = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+
+    FILE *trace = fopen(argv[1], "rb");
+
+    if (trace == NULL) {
+        log_error("failed to open trace %s, errno: %d", argv[1], -errno);
+        return -1;
+    }
+
+    struct trace_header_t header;
+
+    if (fread(&header, sizeof(header), 1, trace) != 1 ||
+        header.magic != RMMAP_TRACE_MAGIC ||
+        header.version != RMMAP_TRACE_VERSION ||
+        header.page_size != RMMAP_PAGE_SIZE) {
+        log_error("%s is not a compatible trace", argv[1]);
+        return -1;
+    }
+
+    int ret = rmmap_open_env();
+
+    if (ret != 0) {
+        log_error("failed to map the remote region, ret: %d", ret);
+        return -1;
+    }
+
+    volatile char *base = (volatile char *) rmmap_base();
+    size_t length = rmmap_length();
+
+    struct trace_record_t record;
+    uint64_t count = 0, skipped = 0, misses = 0, latency = 0;
+    uint64_t start = rmmap_now_ns();
+
+    while (fread(&record, sizeof(record), 1, trace) == 1) {
+        if (record.region != 0 || record.offset >= length) {
+            skipped++;
+            continue;
+        }
+
+        if (speed > 0) {
+            wait_until(start + (uint64_t) (record.timestamp / speed));
+        }
+
+        if (record.op == RMMAP_TRACE_DROP) {
+            rmmap_drop((char *) base + record.offset, record.length);
+            count++;
+            continue;
+        }
+
+        if (record.op == RMMAP_TRACE_ADVICE) {
+            rmadvise((char *) base + record.offset, record.length, record.source);
+            count++;
+            continue;
+        }
+
+        if (record.op == RMMAP_TRACE_WRITE) {
+            base[record.offset] = base[record.offset];
+        } else {
+            (void) base[record.offset];
+        }
+
+        if (record.source != RMMAP_TRACE_HIT && record.source != RMMAP_TRACE_PREFETCH) {
+            misses++;
+            latency += record.latency;
+        }
+
+        count++;
+    }
+
+    uint64_t elapsed = rmmap_now_ns() - start;
+    fclose(trace);
+    rmmap_trace_flush();
+
+    log_info("replayed %lu records (%lu skipped) in %.3f ms",
+        (unsigned long) count, (unsigned long) skipped, elapsed / 1e6);
+    log_info("recorded misses: %lu, mean fault latency: %.1f us",
+        (unsigned long) misses, misses ? latency / 1e3 / misses : 0.0);
+
+    struct rmmap_stats_t stats;
+    rmmap_get_stats(&stats);
+
+    log_info("replayed faults: %lu, misses: %lu, transfers: %lu, prefetch hits: %lu, "
+        "mean fault latency: %.1f us",
+        (unsigned long) stats.faults, (unsigned long) stats.misses,
+        (unsigned long) stats.transfers, (unsigned long) stats.prefetch_hits,
+        stats.faults ? stats.fault_ns / 1e3 / stats.faults : 0.0);
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <liburing.h>
+
+#include "simple_common.h"
+#include "rmmap.h"
+#include "rmmap_ssd.h"
+
+#define NO_SLOT UINT32_MAX
+#define NO_PAGE UINT32_MAX
+
+#define SLOT_VALID   0x1  // content on ssd matches the remote page
+#define SLOT_PENDING 0x2  // write in flight
+
+#define WRITE_DEPTH 32
+// every EXPLORE_PERIOD-th miss takes the slower tier to refresh its latency
+#define EXPLORE_PERIOD 64
+
+struct ssd_write_t {
+    uint32_t slot;
+    uint32_t page;
+    char *buffer;
+};
+
+static int fd = -1;
+static struct io_uring ring;
+
+// compact index: remote page -> ssd slot, and slot -> page for reclaim
+static uint32_t *page_slot = NULL;
+static uint32_t *slot_page = NULL;
+static uint8_t *slot_state = NULL;
+static size_t slot_num = 0;
+static size_t slot_hand = 0;
+
+static struct ssd_write_t writes[WRITE_DEPTH];
+static struct ssd_write_t *free_writes[WRITE_DEPTH];
+static int free_write_num = 0;
+
+// moving averages of page read latency in nanoseconds
+static uint64_t ssd_ns = 0;
+static uint64_t remote_ns = 0;
+static uint64_t miss_count = 0;
+
+static void update_average(uint64_t *average, uint64_t sample) {
+    *average = *average == 0 ? sample : (*average * 7 + sample) / 8;
+}
+
+int rmmap_ssd_enabled() {
+    return fd >= 0;
+}
+
+int rmmap_ssd_init(const char *path, size_t slots, size_t pages) {
+    if (slots == 0 || slots >= NO_SLOT || pages >= NO_PAGE) {
+        return -EINVAL;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0600);
+
+    if (fd < 0) {
+        log_error("failed to open ssd cache %s, errno: %d", path, -errno);
+        return -errno;
+    }
+
+    if (ftruncate(fd, (off_t) slots * RMMAP_PAGE_SIZE) != 0) {
+        log_error("failed to size ssd cache, errno: %d", -errno);
+        goto fail;
+    }
+
+    int ret = io_uring_queue_init(WRITE_DEPTH, &ring, 0);
+
+    if (ret != 0) {
+        log_error("failed to setup io_uring, ret: %d", ret);
+        errno = -ret;
+        goto fail;
+    }
+
+    page_slot = rmmap_map_anon(pages * sizeof(uint32_t), PROT_READ | PROT_WRITE);
+    slot_page = rmmap_map_anon(slots * sizeof(uint32_t), PROT_READ | PROT_WRITE);
+    slot_state = rmmap_map_anon(slots, PROT_READ | PROT_WRITE);
+    char *buffers = rmmap_map_anon(WRITE_DEPTH * RMMAP_PAGE_SIZE, PROT_READ | PROT_WRITE);
+
+    if (page_slot == NULL || slot_page == NULL || slot_state == NULL || buffers == NULL) {
+        log_error("failed to map ssd cache index");
+        io_uring_queue_exit(&ring);
+        goto fail;
+    }
+
+    memset(page_slot, 0xff, pages * sizeof(uint32_t));
+    memset(slot_page, 0xff, slots * sizeof(uint32_t));
+
+    for (int i = 0; i < WRITE_DEPTH; i++) {
+        writes[i].buffer = buffers + (size_t) i * RMMAP_PAGE_SIZE;
+        free_writes[free_write_num++] = &writes[i];
+    }
+
+    slot_num = slots;
+    log_info("ssd cache %s opened: %lu pages", path, (unsigned long) slots);
+    return 0;
+
+fail:
+    close(fd);
+    fd = -1;
+    return -errno;
+}
+
+static void complete_write(struct io_uring_cqe *cqe) {
+    struct ssd_write_t *write = io_uring_cqe_get_data(cqe);
+
+    slot_state[write->slot] &= ~SLOT_PENDING;
+
+    // the page may have been forgotten while the write was in flight
+    if (cqe->res == RMMAP_PAGE_SIZE && slot_page[write->slot] == write->page) {
+        slot_state[write->slot] |= SLOT_VALID;
+    } else if (slot_page[write->slot] == write->page) {
+        page_slot[write->page] = NO_SLOT;
+        slot_page[write->slot] = NO_PAGE;
+    }
+
+    io_uring_cqe_seen(&ring, cqe);
+    free_writes[free_write_num++] = write;
+}
+
+static void reap_writes(int wait) {
+    struct io_uring_cqe *cqe;
+
+    if (wait && io_uring_wait_cqe(&ring, &cqe) == 0) {
+        complete_write(cqe);
+    }
+
+    while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+        complete_write(cqe);
+    }
+}
+
+static void release_slot(uint32_t slot) {
+    if (slot_page[slot] != NO_PAGE) {
+        page_slot[slot_page[slot]] = NO_SLOT;
+        slot_page[slot] = NO_PAGE;
+    }
+    slot_state[slot] &= ~SLOT_VALID;
+}
+
+static uint32_t claim_slot(size_t page) {
+    for (size_t i = 0; i < slot_num; i++) {
+        uint32_t slot = slot_hand;
+        slot_hand = (slot_hand + 1) % slot_num;
+
+        // a pending slot can not be reused, writes to it may be reordered
+        if (!(slot_state[slot] & SLOT_PENDING)) {
+            release_slot(slot);
+            slot_page[slot] = page;
+            page_slot[page] = slot;
+            return slot;
+        }
+    }
+
+    return NO_SLOT;
+}
+
+int rmmap_ssd_store(size_t page, const void *content) {
+    if (!rmmap_ssd_enabled()) {
+        return -ENODEV;
+    }
+
+    reap_writes(0);
+
+    // already cached or on its way, pages are forgotten once written to
+    if (page_slot[page] != NO_SLOT) {
+        return 0;
+    }
+
+    uint32_t slot = claim_slot(page);
+
+    if (slot == NO_SLOT) {
+        return -ENOSPC;
+    }
+
+    if (free_write_num == 0) {
+        reap_writes(1);
+    }
+
+    struct ssd_write_t *write = free_writes[--free_write_num];
+    write->slot = slot;
+    write->page = page;
+    memcpy(write->buffer, content, RMMAP_PAGE_SIZE);
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_write(sqe, fd, write->buffer, RMMAP_PAGE_SIZE,
+                        (off_t) slot * RMMAP_PAGE_SIZE);
+    io_uring_sqe_set_data(sqe, write);
+
+    slot_state[slot] = SLOT_PENDING;
+
+    int ret = io_uring_submit(&ring);
+
+    if (ret < 0) {
+        log_error("failed to submit ssd write, ret: %d", ret);
+        slot_state[slot] = 0;
+        release_slot(slot);
+        free_writes[free_write_num++] = write;
+        return ret;
+    }
+
+    return 0;
+}
+
+int rmmap_ssd_load(size_t page, void *buffer) {
+    if (!rmmap_ssd_enabled()) {
+        return -ENOENT;
+    }
+
+    reap_writes(0);
+
+    uint32_t slot = page_slot[page];
+
+    if (slot == NO_SLOT || !(slot_state[slot] & SLOT_VALID)) {
+        return -ENOENT;
+    }
+
+    // take the tier with the lower observed latency, and the other one now
+    // and then so its average stays current
+    int prefer_ssd = ssd_ns <= remote_ns;
+    if (++miss_count % EXPLORE_PERIOD == 0) {
+        prefer_ssd = !prefer_ssd;
+    }
+
+    if (!prefer_ssd) {
+        return -EAGAIN;
+    }
+
+    uint64_t start = rmmap_now_ns();
+    ssize_t ret = pread(fd, buffer, RMMAP_PAGE_SIZE, (off_t) slot * RMMAP_PAGE_SIZE);
+
+    if (ret != RMMAP_PAGE_SIZE) {
+        log_error("failed to read ssd slot %u, ret: %ld", slot, (long) ret);
+        release_slot(slot);
+        return -ENOENT;
+    }
+
+    update_average(&ssd_ns, rmmap_now_ns() - start);
+    return 0;
+}
+
+void rmmap_ssd_forget(size_t page) {
+    if (!rmmap_ssd_enabled() || page_slot[page] == NO_SLOT) {
+        return;
+    }
+
+    // a pending write finds the slot released when it completes
+    release_slot(page_slot[page]);
+}
+
+void rmmap_ssd_note_remote(uint64_t ns) {
+    update_average(&remote_ns, ns);
+}
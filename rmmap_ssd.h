@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// optional second cache tier on a local ssd, clean copies of evicted pages
+// are written asynchronously with io_uring to an O_DIRECT cache file
+
+extern int rmmap_ssd_init(const char *path, size_t slot_num, size_t page_num);
+
+extern int rmmap_ssd_enabled();
+
+// queue a copy of an evicted clean page, the remote copy must already be
+// valid and the page forgotten whenever it is written to
+extern int rmmap_ssd_store(size_t page, const void *content);
+
+// read a page into an aligned buffer, returns -ENOENT if it is not cached
+// and -EAGAIN if fetching it remotely is expected to be faster
+extern int rmmap_ssd_load(size_t page, void *buffer);
+
+// invalidate the cached copy of a page
+extern void rmmap_ssd_forget(size_t page);
+
+// feed the latency of a remote page read, in nanoseconds
+extern void rmmap_ssd_note_remote(uint64_t ns);
@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "simple_common.h"
+#include "rmmap.h"
+#include "rmmap_trace.h"
+
+#define TRACE_BUFFER_RECORDS 4096
+
+static int fd = -1;
+static uint64_t epoch = 0;
+
+// records are buffered and written out in batches
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_record_t *records = NULL;
+static size_t record_num = 0;
+
+int rmmap_trace_enabled() {
+    return fd >= 0;
+}
+
+int rmmap_trace_open(const char *path) {
+    records = rmmap_map_anon(TRACE_BUFFER_RECORDS * sizeof(struct trace_record_t),
+                             PROT_READ | PROT_WRITE);
+
+    if (records == NULL) {
+        log_error("failed to map trace buffer");
+        return -ENOMEM;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        log_error("failed to open trace %s, errno: %d", path, -errno);
+        return -errno;
+    }
+
+    struct trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RMMAP_TRACE_MAGIC;
+    header.version = RMMAP_TRACE_VERSION;
+    header.page_size = RMMAP_PAGE_SIZE;
+
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        log_error("failed to write trace header, errno: %d", -errno);
+        close(fd);
+        fd = -1;
+        return -EIO;
+    }
+
+    epoch = rmmap_now_ns();
+    atexit(rmmap_trace_flush);
+
+    log_info("tracing remote accesses to %s", path);
+    return 0;
+}
+
+// trace_lock held
+static void write_records() {
+    if (record_num == 0) {
+        return;
+    }
+
+    size_t length = record_num * sizeof(struct trace_record_t);
+
+    if (write(fd, records, length) != (ssize_t) length) {
+        log_error("failed to write trace, errno: %d", -errno);
+    }
+
+    record_num = 0;
+}
+
+void rmmap_trace_record(uint8_t op, uint8_t source, uint64_t offset,
+                        uint32_t length, uint64_t start) {
+    if (!rmmap_trace_enabled()) {
+        return;
+    }
+
+    uint64_t now = rmmap_now_ns();
+
+    pthread_mutex_lock(&trace_lock);
+
+    struct trace_record_t *record = &records[record_num++];
+
+    record->timestamp = start - epoch;
+    record->offset = offset;
+    record->length = length;
+    record->latency = now - start > UINT32_MAX ? UINT32_MAX : (uint32_t) (now - start);
+    record->region = 0;
+    record->op = op;
+    record->source = source;
+
+    if (record_num == TRACE_BUFFER_RECORDS) {
+        write_records();
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// also runs from atexit() while other threads may still be recording
+void rmmap_trace_flush() {
+    if (!rmmap_trace_enabled()) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    write_records();
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,53 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// compact binary trace of remote memory accesses, a trace_header_t followed
+// by trace_record_t entries
+//
+// accesses are only seen when they fault, a page touched again while it is
+// resident and referenced leaves no record, so the trace holds the misses,
+// write upgrades, first touches of prefetched pages and one touch per clock
+// pass, plus the drop and advice calls that change what is resident
+
+#define RMMAP_TRACE_MAGIC 0x65636172746d6d72ull  // "rmmtrace"
+#define RMMAP_TRACE_VERSION 2
+
+// op
+#define RMMAP_TRACE_READ  0  // first access to a non-resident page, or first
+                             // touch of a resident one after the clock passed
+                             // or a prefetch brought it in
+#define RMMAP_TRACE_WRITE 1  // first write to a resident clean page
+#define RMMAP_TRACE_DROP   2  // rmmap_drop() of the range, from free() or munmap()
+#define RMMAP_TRACE_ADVICE 3  // rmadvise() on the range, source holds the advice
+
+// source a READ or WRITE was served from, anything but HIT is a cache miss
+#define RMMAP_TRACE_HIT    0
+#define RMMAP_TRACE_ZERO   1  // never written page, no transfer
+#define RMMAP_TRACE_SSD    2
+#define RMMAP_TRACE_REMOTE 3
+#define RMMAP_TRACE_PREFETCH 4  // first touch of a page a prefetch brought in
+
+struct __attribute((packed)) trace_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+};
+
+struct __attribute((packed)) trace_record_t {
+    uint64_t timestamp;  // nanoseconds since the trace was opened
+    uint64_t offset;     // within the region
+    uint32_t length;
+    uint32_t latency;    // fault or call latency in nanoseconds
+    uint16_t region;     // 0 for the region mapped by rmmap_init()
+    uint8_t op;
+    uint8_t source;
+};
+
+extern int rmmap_trace_open(const char *path);
+
+extern int rmmap_trace_enabled();
+
+extern void rmmap_trace_record(uint8_t op, uint8_t source, uint64_t offset,
+                               uint32_t length, uint64_t start);
+
+extern void rmmap_trace_flush();
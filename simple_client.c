@@ -1,4 +1,8 @@
 #include "simple_client.h"
+#include "rmmap_kv.h"
+
+const char *host_ip = "192.168.31.140";
+const uint16_t host_port = 1717;
 
 static struct sockaddr_in server_sockaddr;
 static struct meta_t meta;
@@ -108,7 +112,7 @@ static int setup_resources() {
     log_info("completion channel created");
 
     // create cq
-    cq = ibv_create_cq(client_cmid->verbs, 16, NULL, comp_channel, 0);
+    cq = ibv_create_cq(client_cmid->verbs, 2 * RMMAP_QUEUE_DEPTH, NULL, comp_channel, 0);
 
     if (cq == NULL) {
         log_error("failed to create cq, errno: %d", -errno);
@@ -133,7 +137,8 @@ static int setup_resources() {
     qp_init_attr.sq_sig_all = 1;
     qp_init_attr.send_cq = cq;
     qp_init_attr.recv_cq = cq;
-    qp_init_attr.cap.max_send_wr = 1;
+    // a batch of async wrs plus one synchronous wr
+    qp_init_attr.cap.max_send_wr = RMMAP_QUEUE_DEPTH + 1;
     qp_init_attr.cap.max_recv_wr = 1;
     qp_init_attr.cap.max_send_sge = 1;
     qp_init_attr.cap.max_recv_sge = 1;
@@ -179,14 +184,28 @@ int pre_post_meta_buf() {
 }
 
 int connect_to_server() {
+    struct ibv_device_attr device_attr;
+    int ret = ibv_query_device(client_cmid->verbs, &device_attr);
+
+    if (ret != 0) {
+        log_error("failed to query device, ret: %d", ret);
+        return -ret;
+    }
+
+    // allow as many outstanding READs as the prefetch queue can post
     struct rdma_conn_param conn_param;
     struct rdma_cm_event *event = NULL;
     memset(&conn_param, 0, sizeof(conn_param));
-    conn_param.initiator_depth = 3;
-    conn_param.responder_resources = 3;
+    conn_param.initiator_depth = device_attr.max_qp_init_rd_atom < RMMAP_QUEUE_DEPTH ?
+                                 device_attr.max_qp_init_rd_atom : RMMAP_QUEUE_DEPTH;
+    conn_param.responder_resources = device_attr.max_qp_rd_atom < RMMAP_QUEUE_DEPTH ?
+                                     device_attr.max_qp_rd_atom : RMMAP_QUEUE_DEPTH;
     conn_param.retry_count = 3;
 
-    int ret = rdma_connect(client_cmid, &conn_param);
+    log_info("connecting with rd atom depth: initiator=%u, responder=%u",
+        conn_param.initiator_depth, conn_param.responder_resources);
+
+    ret = rdma_connect(client_cmid, &conn_param);
 
     if (ret != 0) {
         log_error("failed to connect to remote host , errno: %d", -errno);
@@ -270,40 +289,302 @@ int read_data() {
     return 0;
 }
 
-int main() {
+int rmmap_connect(const char *ip, uint16_t port) {
     server_sockaddr.sin_family = AF_INET;
-    server_sockaddr.sin_addr.s_addr = inet_addr(host_ip);
-    server_sockaddr.sin_port = htons(host_port);
+    server_sockaddr.sin_addr.s_addr = inet_addr(ip);
+    server_sockaddr.sin_port = htons(port);
 
     int ret = setup_resources();
-    
+
     if (ret != 0) {
         log_error("failed to setup resources");
-        exit(-1);
+        return ret;
     }
 
     ret = pre_post_meta_buf();
 
     if (ret != 0) {
         log_error("failed to pre-post metadata recv buffer");
-        exit(-1);
+        return ret;
     }
 
     ret = connect_to_server();
 
     if (ret != 0) {
         log_error("failed to connect to server");
-        exit(-1);
+        return ret;
     }
 
     ret = read_meta();
 
     if (ret != 0) {
         log_error("failed to fetch meta");
+        return ret;
+    }
+
+    return 0;
+}
+
+uint64_t rmmap_remote_length() {
+    return meta.length;
+}
+
+struct ibv_mr *rmmap_reg_local(void *buf, size_t length) {
+    struct ibv_mr *mr = ibv_reg_mr(pd, buf, length, IBV_ACCESS_LOCAL_WRITE);
+
+    if (mr == NULL) {
+        log_error("failed to register local buffer, errno: %d", -errno);
+    }
+
+    return mr;
+}
+
+// completions of async wrs seen while waiting for a synchronous one
+static uint64_t async_done[RMMAP_QUEUE_DEPTH];
+static int async_status[RMMAP_QUEUE_DEPTH];
+static int async_done_num = 0;
+
+int rmmap_post_async(enum ibv_wr_opcode opcode, struct ibv_mr *mr,
+                     char **locals, const uint64_t *remote_offsets,
+                     const uint64_t *wr_ids, int n, uint32_t length) {
+    struct ibv_sge sges[RMMAP_QUEUE_DEPTH];
+    struct ibv_send_wr wrs[RMMAP_QUEUE_DEPTH], *bad_wr = NULL;
+
+    if (n <= 0 || n > RMMAP_QUEUE_DEPTH) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (remote_offsets[i] + length > meta.length) {
+            log_error("remote access out of range: offset=%lu, length=%u",
+                (unsigned long) remote_offsets[i], length);
+            return -EINVAL;
+        }
+
+        sges[i].addr = (uint64_t) locals[i];
+        sges[i].length = length;
+        sges[i].lkey = mr->lkey;
+
+        memset(&wrs[i], 0, sizeof(wrs[i]));
+        wrs[i].wr_id = wr_ids[i];
+        wrs[i].next = i + 1 < n ? &wrs[i + 1] : NULL;
+        wrs[i].sg_list = &sges[i];
+        wrs[i].num_sge = 1;
+        wrs[i].opcode = opcode;
+        wrs[i].send_flags = IBV_SEND_SIGNALED;
+        wrs[i].wr.rdma.rkey = meta.key;
+        wrs[i].wr.rdma.remote_addr = meta.address + remote_offsets[i];
+    }
+
+    // chained, so the whole batch rings the doorbell once
+    int ret = ibv_post_send(client_cmid->qp, wrs, &bad_wr);
+
+    if (ret != 0) {
+        // the wrs before bad_wr are posted and will complete
+        int posted = bad_wr != NULL ? (int) (bad_wr - wrs) : 0;
+        log_error("failed to post rdma wr %d of %d, errno: %d", posted, n, ret);
+        return posted > 0 ? posted : -ret;
+    }
+
+    return n;
+}
+
+int rmmap_post_rw(enum ibv_wr_opcode opcode, struct ibv_mr *mr,
+                  void *local, uint64_t remote_offset, uint32_t length) {
+    char *locals[1] = { (char *) local };
+    uint64_t wr_ids[1] = { 0 };
+
+    int ret = rmmap_post_async(opcode, mr, locals, &remote_offset, wr_ids, 1, length);
+
+    if (ret != 1) {
+        return ret;
+    }
+
+    // busy polling, this may run inside the page fault handler, async
+    // completions met on the way are kept for rmmap_poll_async()
+    while (1) {
+        struct ibv_wc wc;
+        ret = ibv_poll_cq(cq, 1, &wc);
+
+        if (ret < 0) {
+            log_error("failed to poll cq for wc due to %d", ret);
+            return ret;
+        }
+
+        if (ret == 0) {
+            continue;
+        }
+
+        int status = 0;
+
+        if (wc.status != IBV_WC_SUCCESS) {
+            log_error("wc has error status: %s", ibv_wc_status_str(wc.status));
+            status = -(wc.status);
+        }
+
+        if (wc.wr_id == 0) {
+            return status;
+        }
+
+        async_done[async_done_num] = wc.wr_id;
+        async_status[async_done_num] = status;
+        async_done_num++;
+    }
+}
+
+int rmmap_poll_async(uint64_t *wr_ids, int *status, int max, int wait) {
+    int n = 0;
+
+    while (n < max && async_done_num > 0) {
+        async_done_num--;
+        wr_ids[n] = async_done[async_done_num];
+        status[n] = async_status[async_done_num];
+        n++;
+    }
+
+    while (n < max) {
+        struct ibv_wc wcs[RMMAP_QUEUE_DEPTH];
+        int want = max - n < RMMAP_QUEUE_DEPTH ? max - n : RMMAP_QUEUE_DEPTH;
+        int ret = ibv_poll_cq(cq, want, wcs);
+
+        if (ret < 0) {
+            log_error("failed to poll cq for wc due to %d", ret);
+            return ret;
+        }
+
+        for (int i = 0; i < ret; i++) {
+            status[n] = 0;
+
+            if (wcs[i].status != IBV_WC_SUCCESS) {
+                log_error("async wc has error status: %s",
+                          ibv_wc_status_str(wcs[i].status));
+                status[n] = -(wcs[i].status);
+            }
+
+            wr_ids[n++] = wcs[i].wr_id;
+        }
+
+        if (ret == 0 && (n > 0 || !wait)) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+// remote kv table state, see rmmap_kv.h
+static struct kv_header_t kv_header;
+static struct kv_slot_t *kv_buffer = NULL;
+static struct ibv_mr *kv_mr = NULL;
+
+static void kv_release() {
+    if (kv_mr != NULL) {
+        ibv_dereg_mr(kv_mr);
+        kv_mr = NULL;
+    }
+
+    free(kv_buffer);
+    kv_buffer = NULL;
+}
+
+int rmmap_kv_open() {
+    kv_buffer = (struct kv_slot_t *) malloc(RMMAP_KV_NEIGHBORHOOD * sizeof(struct kv_slot_t));
+
+    if (kv_buffer == NULL) {
+        log_error("failed to allocate kv buffer");
+        return -ENOMEM;
+    }
+
+    kv_mr = rmmap_reg_local(kv_buffer, RMMAP_KV_NEIGHBORHOOD * sizeof(struct kv_slot_t));
+
+    if (kv_mr == NULL) {
+        int ret = -errno;
+        kv_release();
+        return ret;
+    }
+
+    int ret = rmmap_post_rw(IBV_WR_RDMA_READ, kv_mr, kv_buffer, 0, sizeof(kv_header));
+
+    if (ret != 0) {
+        log_error("failed to read kv header, ret: %d", ret);
+        kv_release();
+        return ret;
+    }
+
+    memcpy(&kv_header, kv_buffer, sizeof(kv_header));
+
+    if (kv_header.magic != RMMAP_KV_MAGIC ||
+        kv_header.slot_size != sizeof(struct kv_slot_t)) {
+        log_error("remote region is not a kv table");
+        kv_release();
+        return -EINVAL;
+    }
+
+    log_info("kv table opened: %u slots", kv_header.slot_num);
+    return 0;
+}
+
+int rmmap_kv_get(const char *key, size_t key_length, char *value, size_t *value_length) {
+    if (kv_mr == NULL || key_length == 0 || key_length > RMMAP_KV_KEY_SIZE) {
+        return -EINVAL;
+    }
+
+    uint64_t offset = rmmap_kv_neighborhood(&kv_header, key, key_length);
+    int ret = -EAGAIN;
+
+    // a torn neighborhood is read again
+    for (int i = 0; i < 16 && ret == -EAGAIN; i++) {
+        ret = rmmap_post_rw(IBV_WR_RDMA_READ, kv_mr, kv_buffer, offset,
+                            RMMAP_KV_NEIGHBORHOOD * sizeof(struct kv_slot_t));
+
+        if (ret != 0) {
+            return ret;
+        }
+
+        ret = rmmap_kv_match(kv_buffer, key, key_length, value, value_length);
+    }
+
+    return ret;
+}
+
+#ifndef RMMAP_LIBRARY
+static int get_key(const char *key) {
+    char value[RMMAP_KV_VALUE_SIZE + 1];
+    size_t value_length = 0;
+
+    int ret = rmmap_kv_open();
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = rmmap_kv_get(key, strlen(key), value, &value_length);
+
+    if (ret != 0) {
+        log_error("failed to get key %s, ret: %d", key, ret);
+        return ret;
+    }
+
+    value[value_length] = '\0';
+    printf("%s '%s'\n", key, value);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int ret = rmmap_connect(host_ip, host_port);
+
+    if (ret != 0) {
         exit(-1);
     }
 
+    // simple_client get <key>
+    if (argc > 2 && strcmp(argv[1], "get") == 0) {
+        ret = get_key(argv[2]);
+        return ret == 0 ? 0 : -1;
+    }
+
     ret = read_data();
 
     return 0;
 }
+#endif
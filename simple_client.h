@@ -11,5 +11,42 @@
 
 #include "simple_common.h"
 
-const char *host_ip = "192.168.31.140";
-const uint16_t host_port = 1717;
+// max async wrs in flight on the client qp
+#define RMMAP_QUEUE_DEPTH 16
+
+extern const char *host_ip;
+extern const uint16_t host_port;
+
+// connect to a server and fetch the meta of its exported region
+extern int rmmap_connect(const char *ip, uint16_t port);
+
+// length of the remote region, valid after rmmap_connect()
+extern uint64_t rmmap_remote_length();
+
+// register a local buffer for use with rmmap_post_rw()
+extern struct ibv_mr *rmmap_reg_local(void *buf, size_t length);
+
+// synchronous one-sided READ/WRITE between mr and the remote region
+extern int rmmap_post_rw(enum ibv_wr_opcode opcode, struct ibv_mr *mr,
+                         void *local, uint64_t remote_offset, uint32_t length);
+
+// post a batch of async READ/WRITEs of length bytes each, wr_ids must be
+// non-zero and at most RMMAP_QUEUE_DEPTH wrs may be in flight
+// returns the number of wrs posted, which is less than n if posting failed
+// part way, only those will complete
+extern int rmmap_post_async(enum ibv_wr_opcode opcode, struct ibv_mr *mr,
+                            char **locals, const uint64_t *remote_offsets,
+                            const uint64_t *wr_ids, int n, uint32_t length);
+
+// collect wr_ids of completed async wrs, status is 0 or the negative wc
+// status of each, if wait is set block until at least one completes
+// returns the number collected, negative only if the cq can not be polled
+extern int rmmap_poll_async(uint64_t *wr_ids, int *status, int max, int wait);
+
+// open the kv table exported by "simple_server kv", see rmmap_kv.h
+extern int rmmap_kv_open();
+
+// one-sided GET, returns 0 if found, -ENOENT if not and -EINVAL for a key
+// that can not be stored
+extern int rmmap_kv_get(const char *key, size_t key_length,
+                        char *value, size_t *value_length);
@@ -15,8 +15,15 @@
     fprintf(stderr, "[error] %s:%d : " msg "\n", __FILE__, __LINE__, ## args);\
 } while(0);
 
+// the preloaded library must not write into the host program's stdout
+#ifdef RMMAP_LIBRARY
+#define LOG_INFO_STREAM stderr
+#else
+#define LOG_INFO_STREAM stdout
+#endif
+
 #define log_info(msg, args...) do {\
-    fprintf(stdout, "[info] %s:%d : " msg "\n", __FILE__, __LINE__, ## args);\
+    fprintf(LOG_INFO_STREAM, "[info] %s:%d : " msg "\n", __FILE__, __LINE__, ## args);\
 } while(0);
 
 struct __attribute((packed)) meta_t {
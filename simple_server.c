@@ -1,22 +1,36 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <string.h>
 
 #include "simple_server.h"
+#include "rmmap_kv.h"
 
-static struct meta_t meta;
+// far memory is split into slices, one per connected client
+#define MAX_SLICES 64
+
+static struct meta_t metas[MAX_SLICES];
+static struct rdma_cm_id *slice_owner[MAX_SLICES];
+static int slice_num = 1;
 
 static struct ibv_pd *pd = NULL;
-static struct ibv_mr *data_mr, *meta_mr = NULL;
+// one mr per slice, so a client's rkey reaches only its own slice
+static struct ibv_mr *data_mrs[MAX_SLICES], *meta_mr = NULL;
 static struct rdma_event_channel *cm_event_channel = NULL;
 static struct ibv_context *device_context = NULL;
+static struct ibv_device_attr device_attr;
 static struct ibv_comp_channel *comp_channel = NULL;
-static struct ibv_sge server_send_sge;
-static struct ibv_send_wr server_send_wr, *err_server_send_wr = NULL;
 
 static const char *data = "hello world!";
 
+// exported region, either the static message or far memory for clients
+static void *region = NULL;
+static size_t region_length = 0;
+static int region_flags = IBV_ACCESS_REMOTE_READ;
+// read-only regions are handed whole to every client
+static int region_shared = 1;
+
 static int on_connect_request(struct rdma_cm_event *cm_event);
 static int on_established(struct rdma_cm_event *cm_event);
 static int on_disconnected(struct rdma_cm_event *cm_event);
@@ -58,6 +72,11 @@ static int setup_resources() {
         return -1;
     }
 
+    if (ibv_query_device(device_context, &device_attr) != 0) {
+        log_error("cannot query device");
+        return -1;
+    }
+
     // create pd
     pd = ibv_alloc_pd(device_context);
     
@@ -68,28 +87,38 @@ static int setup_resources() {
 
     log_info("pd created");
 
-    int mr_flags = IBV_ACCESS_REMOTE_READ;
+    int mr_flags = region_flags;
 
-    // create & register mr
-    data_mr = ibv_reg_mr(pd, (void *) data, strlen(data) + 1, mr_flags);
+    // create server metas, one page aligned slice each
+    uint64_t slice_length = (region_length / slice_num) & ~(uint64_t) 4095;
 
-    if (data_mr == NULL) {
-        log_error("failed to create server data mr");
-        return -errno;
+    if (region_shared) {
+        slice_length = region_length;
     }
 
-    log_info("data mr registered: addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x",
-        data, data_mr->lkey, data_mr->rkey, mr_flags);
+    // create & register one mr per slice
+    for (int i = 0; i < slice_num; i++) {
+        void *slice = (char *) region + i * slice_length;
 
-    // create server meta
-    meta.address = (uint64_t) data_mr->addr;
-    meta.length = data_mr->length;
-    meta.key = data_mr->lkey;
+        data_mrs[i] = ibv_reg_mr(pd, slice, slice_length, mr_flags);
+
+        if (data_mrs[i] == NULL) {
+            log_error("failed to create server data mr for slice %d", i);
+            return -errno;
+        }
+
+        log_info("data mr registered: addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x",
+            slice, data_mrs[i]->lkey, data_mrs[i]->rkey, mr_flags);
+
+        metas[i].address = (uint64_t) data_mrs[i]->addr;
+        metas[i].length = slice_length;
+        metas[i].key = data_mrs[i]->rkey;
+    }
 
     // register meta_mr
     mr_flags = IBV_ACCESS_LOCAL_WRITE;
 
-    meta_mr = ibv_reg_mr(pd, &meta, sizeof(meta), mr_flags);
+    meta_mr = ibv_reg_mr(pd, metas, sizeof(metas), mr_flags);
 
     if (meta_mr == NULL) {
         log_error("failed to create server meta mr");
@@ -97,7 +126,7 @@ static int setup_resources() {
     }
 
     log_info("server meta mr registered: addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x",
-           &meta, meta_mr->lkey, meta_mr->rkey, mr_flags);
+           metas, meta_mr->lkey, meta_mr->rkey, mr_flags);
 
     // create completion channel
     comp_channel = ibv_create_comp_channel(device_context);
@@ -109,17 +138,6 @@ static int setup_resources() {
 
     log_info("completion channel created");
 
-    // setup static meta message
-    server_send_sge.addr = (uint64_t) &meta;
-    server_send_sge.length = sizeof(meta);
-    server_send_sge.lkey = meta_mr->lkey;
-
-    memset(&server_send_wr, 0, sizeof(server_send_wr));
-    server_send_wr.sg_list = &server_send_sge;
-    server_send_wr.num_sge = 1;
-    server_send_wr.opcode = IBV_WR_SEND;
-    // server_send_wr.send_flags = IBV_SEND_SIGNALED;
-
     return 0;
 }
 
@@ -217,13 +235,47 @@ static void run_event_loop() {
     }
 }
 
+static int take_slice(struct rdma_cm_id *cm_client_id) {
+    if (region_shared) {
+        return 0;
+    }
+
+    for (int i = 0; i < slice_num; i++) {
+        if (slice_owner[i] == NULL) {
+            slice_owner[i] = cm_client_id;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void release_slice(struct rdma_cm_id *cm_client_id) {
+    for (int i = 0; i < slice_num; i++) {
+        if (slice_owner[i] == cm_client_id) {
+            slice_owner[i] = NULL;
+        }
+    }
+}
+
 static int on_connect_request(struct rdma_cm_event *cm_event) {
     struct rdma_cm_id *cm_client_id = cm_event->id;
 
     // use opened context for shared resources
     cm_client_id->verbs = device_context;
-    
-    log_info("the client rdma connection request is acknowledged");
+
+    // writable far memory must not be shared by two clients
+    int slice = take_slice(cm_client_id);
+
+    if (slice < 0) {
+        log_error("all %d slices are in use, rejecting the client", slice_num);
+        rdma_reject(cm_client_id, NULL, 0);
+        return -EBUSY;
+    }
+
+    cm_client_id->context = &metas[slice];
+
+    log_info("the client rdma connection request is acknowledged, slice %d", slice);
 
     // TODO readonly, seems saving is not required
     // setup client resources
@@ -232,6 +284,7 @@ static int on_connect_request(struct rdma_cm_event *cm_event) {
 
     if (cq == NULL) {
         log_error("failed to create cq, errno: %d", -errno);
+        release_slice(cm_client_id);
         return -errno;
     }
 
@@ -252,21 +305,27 @@ static int on_connect_request(struct rdma_cm_event *cm_event) {
 
     if (ret != 0) {
         log_error("failed to create qp due to errno: %d", -errno);
+        release_slice(cm_client_id);
         return -errno;
     }
 
     log_info("qp created: qpn=0x%x", cm_client_id->qp->qp_num);
 
-    // accept the connection
+    // accept the connection, serving as many outstanding READs as the
+    // client asks for and the device allows
+    struct rdma_conn_param *request = &cm_event->param.conn;
     struct rdma_conn_param conn_param;
     memset(&conn_param, 0, sizeof(conn_param));
-    conn_param.initiator_depth = 3;
-    conn_param.responder_resources = 3;
+    conn_param.responder_resources = request->initiator_depth < device_attr.max_qp_rd_atom ?
+                                     request->initiator_depth : device_attr.max_qp_rd_atom;
+    conn_param.initiator_depth = request->responder_resources < device_attr.max_qp_init_rd_atom ?
+                                 request->responder_resources : device_attr.max_qp_init_rd_atom;
 
     ret = rdma_accept(cm_client_id, &conn_param);
 
     if (ret != 0) {
         log_error("failed to accept the connection, errno: %d", -errno);
+        release_slice(cm_client_id);
         return -errno;
     }
 
@@ -276,6 +335,18 @@ static int on_connect_request(struct rdma_cm_event *cm_event) {
 static int on_established(struct rdma_cm_event *cm_event) {
     // send server meta
     struct rdma_cm_id *cm_client_id = cm_event->id;
+    struct meta_t *meta = cm_client_id->context;
+
+    struct ibv_sge server_send_sge;
+    server_send_sge.addr = (uint64_t) meta;
+    server_send_sge.length = sizeof(*meta);
+    server_send_sge.lkey = meta_mr->lkey;
+
+    struct ibv_send_wr server_send_wr, *err_server_send_wr = NULL;
+    memset(&server_send_wr, 0, sizeof(server_send_wr));
+    server_send_wr.sg_list = &server_send_sge;
+    server_send_wr.num_sge = 1;
+    server_send_wr.opcode = IBV_WR_SEND;
 
     int ret = ibv_post_send(cm_client_id->qp, &server_send_wr, &err_server_send_wr);
     
@@ -290,12 +361,104 @@ static int on_established(struct rdma_cm_event *cm_event) {
 }
 
 static int on_disconnected(struct rdma_cm_event *cm_event) {
+    // hand the slice to the next client
+    release_slice(cm_event->id);
+    log_info("client disconnected");
     // destroy resources
     return 0;
 }
 
-int main() {
+static int setup_kv_region(uint32_t slot_num) {
+    region_length = rmmap_kv_size(slot_num);
+
+    if (slot_num == 0 || region_length > UINT32_MAX) {
+        log_error("invalid kv slot number %u", slot_num);
+        return -1;
+    }
+
+    region = mmap(NULL, region_length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (region == MAP_FAILED) {
+        log_error("failed to map kv table, errno: %d", -errno);
+        return -errno;
+    }
+
+    rmmap_kv_format(region, region_length);
+
+    // load "key value" lines, GETs are served by clients' READs only
+    char line[256], key[256], value[256];
+    int count = 0;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (sscanf(line, "%255s %255s", key, value) != 2) {
+            continue;
+        }
+
+        int ret = rmmap_kv_put(region, key, strlen(key), value, strlen(value));
+
+        if (ret != 0) {
+            log_error("failed to put key %s, ret: %d", key, ret);
+            continue;
+        }
+
+        count++;
+    }
+
+    log_info("kv table of %u slots loaded with %d keys", slot_num, count);
+    return 0;
+}
+
+static int setup_region(int argc, char **argv) {
+    if (argc < 2) {
+        region = (void *) data;
+        region_length = strlen(data) + 1;
+        return 0;
+    }
+
+    // kv table: simple_server kv <slot number> < pairs
+    if (strcmp(argv[1], "kv") == 0) {
+        return setup_kv_region(argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 0) : 1024);
+    }
+
+    // far memory: simple_server <size in MiB> [clients]
+    region_length = strtoull(argv[1], NULL, 0) << 20;
+
+    if (region_length == 0 || region_length > UINT32_MAX) {
+        log_error("far memory size must be in (0, 4096) MiB");
+        return -1;
+    }
+
+    slice_num = argc > 2 ? atoi(argv[2]) : 1;
+
+    if (slice_num < 1 || slice_num > MAX_SLICES || region_length / slice_num < 4096) {
+        log_error("client number must be in [1, %d] and leave a page to each", MAX_SLICES);
+        return -1;
+    }
+
+    region = mmap(NULL, region_length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (region == MAP_FAILED) {
+        log_error("failed to map far memory, errno: %d", -errno);
+        return -errno;
+    }
+
+    region_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    region_shared = 0;
+    log_info("far memory of %lu bytes allocated for %d clients", (unsigned long) region_length, slice_num);
+    return 0;
+}
+
+int main(int argc, char **argv) {
     int ret;
+    ret = setup_region(argc, argv);
+
+    if (ret != 0) {
+        log_error("fail to setup region");
+        exit(-1);
+    }
+
     ret = setup_resources();
 
     if (ret != 0) {